@@ -19,15 +19,39 @@ void mmu_enable();
 // disable MMU
 void mmu_unable();
 
+//  enable L1 instruction and data caches, and branch prediction
+void mmu_cache_enable();
+// invalidate data caches without cleaning them (i.e., only at boot), instruction cache and branch predictor
+void mmu_cache_invalidate();
+// clean data cache lines holding [ x, x + n ) to the point of coherency
+void mmu_clean( void* x, size_t n );
+
 // flush   TLB
 void mmu_flush();
+// flush   TLB entries tagged with ASID x
+void mmu_flush_asid( uint32_t x );
+// flush   TLB entries for the page at address x, tagged with the ASID in x[ 7 : 0 ]
+void mmu_flush_page( uint32_t x );
+// flush   branch predictor
+void mmu_flush_bp();
 
 // configure MMU: set page table pointer #0 to x
 void mmu_set_ptr0( uint32_t* x );
 // configure MMU: set page table pointer #1 to x
 void mmu_set_ptr1( uint32_t* x );
+// configure MMU: set TTBCR.N to x, i.e., translate addresses below 2^( 32 - x ) via pointer #0
+void mmu_set_ttbcr( int x );
+// configure MMU: set current ASID to x
+void mmu_set_asid( uint8_t x );
+// configure MMU: set the user read-only thread ID register (TPIDRURO) to x
+void mmu_set_tls( uint32_t x );
 
 // configure MMU: set 2-bit permission field of domain d to x
 void mmu_set_dom( int d, uint8_t x );
 
+// read data fault status  register (i.e., why  the last data abort occurred)
+uint32_t mmu_get_dfsr();
+// read data fault address register (i.e., where the last data abort occurred)
+uint32_t mmu_get_dfar();
+
 #endif
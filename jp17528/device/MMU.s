@@ -25,13 +25,26 @@
 .global mmu_enable
 .global mmu_unable
 
+.global mmu_cache_enable
+.global mmu_cache_invalidate
+.global mmu_clean
+
 .global mmu_flush
+.global mmu_flush_asid
+.global mmu_flush_page
+.global mmu_flush_bp
 
 .global mmu_set_ptr0
 .global mmu_set_ptr1
+.global mmu_set_ttbcr
+.global mmu_set_asid
+.global mmu_set_tls
 	
 .global mmu_set_dom
 
+.global mmu_get_dfsr
+.global mmu_get_dfar
+
 mmu_enable:          mrc   p15, 0, r0, c1, c0, 0 @ read  SCTLR
                      orr   r0, r0, #0x1          @ set   SCTLR[ M ] = 1 => MMU  enable
                      mcr   p15, 0, r0, c1, c0, 0 @ write SCTLR
@@ -44,16 +57,140 @@ mmu_unable:          mrc   p15, 0, r0, c1, c0, 0 @ read  SCTLR
 
                      mov   pc, lr                @ return
 
+mmu_cache_enable:    mrc   p15, 0, r0, c1, c0, 0 @ read  SCTLR
+                     orr   r0, r0, #0x4          @ set   SCTLR[ C ] = 1 => data        cache enable
+                     orr   r0, r0, #0x1800       @ set   SCTLR[ I ] = 1 => instruction cache enable
+                                                 @ set   SCTLR[ Z ] = 1 => branch prediction enable
+                     mcr   p15, 0, r0, c1, c0, 0 @ write SCTLR
+                     isb                         @ synchronise context
+
+                     mov   pc, lr                @ return
+
+/* Invalidate, without cleaning, every data or unified cache up to the point
+ * of coherency by set/way (per Section B2.2.7 of the ARMv7-A ARM, reading the
+ * geometry of each level from CLIDR and CCSIDR), then invalidate the
+ * instruction cache and the branch predictor.  This is only safe straight
+ * after reset, when the lines hold garbage that must not be written back.
+ */
+
+mmu_cache_invalidate:push  { r4-r11 }
+
+                     mrc   p15, 1, r0, c0, c0, 1 @ read  CLIDR
+                     ands  r3, r0, #0x07000000   @ compute LoC
+                     mov   r3, r3, lsr #23       @ compute LoC * 2
+                     beq   ci_done
+
+                     mov   r10, #0               @ r10 = level * 2, as per CSSELR
+ci_level:            add   r2, r10, r10, lsr #1  @ compute level * 3
+                     mov   r1, r0, lsr r2
+                     and   r1, r1, #0x7          @ compute cache type at this level
+                     cmp   r1, #0x2
+                     blt   ci_skip               @ skip  unless data or unified cache
+
+                     mcr   p15, 2, r10, c0, c0, 0 @ write CSSELR
+                     isb                         @ synchronise CCSIDR
+                     mrc   p15, 1, r1, c0, c0, 0 @ read  CCSIDR
+                     and   r2, r1, #0x7
+                     add   r2, r2, #4            @ compute log2( line length )
+                     ldr   r4, =0x3FF
+                     ands  r4, r4, r1, lsr #3    @ compute maximum way
+                     clz   r5, r4                @ compute way  shift
+                     ldr   r7, =0x7FFF
+                     ands  r7, r7, r1, lsr #13   @ compute maximum set
+
+ci_set:              mov   r9, r4                @ for each set ...
+ci_way:              orr   r11, r10, r9, lsl r5  @ ... and  each way
+                     orr   r11, r11, r7, lsl r2
+                     mcr   p15, 0, r11, c7, c6, 2 @ write DCISW
+                     subs  r9, r9, #1
+                     bge   ci_way
+                     subs  r7, r7, #1
+                     bge   ci_set
+
+ci_skip:             add   r10, r10, #2
+                     cmp   r3, r10
+                     bgt   ci_level
+
+ci_done:             mov   r10, #0
+                     mcr   p15, 2, r10, c0, c0, 0 @ write CSSELR
+                     dsb                         @ complete maintenance
+                     mcr   p15, 0, r10, c7, c5, 0 @ write ICIALLU
+                     mcr   p15, 0, r10, c7, c5, 6 @ write BPIALL
+                     dsb                         @ complete invalidation
+                     isb                         @ synchronise context
+
+                     pop   { r4-r11 }
+
+                     mov   pc, lr                @ return
+
+mmu_clean:           mrc   p15, 0, r3, c0, c0, 1 @ read  CTR
+                     mov   r3, r3, lsr #16
+                     and   r3, r3, #0xF          @ compute log2( line length in words )
+                     mov   r2, #4
+                     mov   r2, r2, lsl r3        @ compute line length
+                     add   r1, r0, r1            @ compute limit
+                     sub   r3, r2, #1
+                     bic   r0, r0, r3            @ align address to line
+l_clean:             mcr   p15, 0, r0, c7, c10, 1 @ write DCCMVAC
+                     add   r0, r0, r2
+                     cmp   r0, r1
+                     blo   l_clean               @ loop if address < limit
+                     dsb                         @ complete clean
+
+                     mov   pc, lr                @ return
+
 mmu_flush:           mov   r0,     #0x0
+                     dsb                         @ complete page table writes
                      mcr   p15, 0, r0, c8, c7, 0 @ write TLBIALL
+                     dsb                         @ complete invalidation
+                     isb                         @ synchronise context
+
+                     mov   pc, lr                @ return
+
+mmu_flush_asid:      dsb                         @ complete page table writes
+                     mcr   p15, 0, r0, c8, c7, 2 @ write TLBIASID
+                     dsb                         @ complete invalidation
+                     isb                         @ synchronise context
+
+                     mov   pc, lr                @ return
+
+mmu_flush_page:      dsb                         @ complete page table writes
+                     mcr   p15, 0, r0, c8, c7, 1 @ write TLBIMVA (r0 = address | ASID)
+                     dsb                         @ complete invalidation
+                     isb                         @ synchronise context
+
+                     mov   pc, lr                @ return
+
+mmu_flush_bp:        mov   r0,     #0x0
+                     mcr   p15, 0, r0, c7, c5, 6 @ write BPIALL
+                     dsb                         @ complete invalidation
+                     isb                         @ synchronise context
 
                      mov   pc, lr                @ return
 
 mmu_set_ptr0:        mcr   p15, 0, r0, c2, c0, 0 @ write TTBR0
+                     isb                         @ synchronise context
 
                      mov   pc, lr                @ return
 
 mmu_set_ptr1:        mcr   p15, 0, r0, c2, c0, 1 @ write TTBR1
+                     isb                         @ synchronise context
+
+                     mov   pc, lr                @ return
+
+mmu_set_ttbcr:       and   r0, r0, #0x7          @ compute N
+                     mcr   p15, 0, r0, c2, c0, 2 @ write TTBCR
+                     isb                         @ synchronise context
+
+                     mov   pc, lr                @ return
+
+mmu_set_asid:        and   r0, r0, #0xFF         @ compute PROCID = 0, ASID = x
+                     mcr   p15, 0, r0, c13, c0, 1 @ write CONTEXTIDR
+                     isb                         @ synchronise context
+
+                     mov   pc, lr                @ return
+
+mmu_set_tls:         mcr   p15, 0, r0, c13, c0, 3 @ write TPIDRURO
 
                      mov   pc, lr                @ return
 
@@ -69,3 +206,10 @@ mmu_set_dom:         add   r0, r0, r0            @ compute i (index      from do
 
                      mov   pc, lr                @ return
 
+mmu_get_dfsr:        mrc   p15, 0, r0, c5, c0, 0 @ read  DFSR
+
+                     mov   pc, lr                @ return
+
+mmu_get_dfar:        mrc   p15, 0, r0, c6, c0, 0 @ read  DFAR
+
+                     mov   pc, lr                @ return
@@ -72,3 +72,109 @@ uint8_t PL011_geth( PL011_t* d,            bool f ) {
 
   return r;
 }
+
+// move bytes from the transmit ring into the transmit FIFO while it has space
+static void PL011_buf_drain( PL011_buf_t* b ) {
+  while( b->tx_tail != b->tx_head && PL011_can_putc( b->d ) ) {
+    b->d->DR = b->tx[ b->tx_tail++ & ( PL011_RING_SIZE - 1 ) ];
+  }
+
+  if( b->tx_tail != b->tx_head ) {
+    b->d->IMSC |=  PL011_INT_TX; // more to send: interrupt once the FIFO drains
+  }
+  else {
+    b->d->IMSC &= ~PL011_INT_TX; // nothing to send: no need to interrupt
+  }
+}
+
+// move bytes from the receive FIFO into the receive ring while there are any
+static void PL011_buf_fill( PL011_buf_t* b ) {
+  while( PL011_can_getc( b->d ) ) {
+    uint8_t x = b->d->DR;
+
+    if( ( b->rx_head - b->rx_tail ) == PL011_RING_SIZE ) {
+      b->rx_overrun++;
+    }
+    else {
+      b->rx[ b->rx_head++ & ( PL011_RING_SIZE - 1 ) ] = x;
+    }
+  }
+}
+
+void     PL011_buf_init ( PL011_buf_t* b, PL011_t* d ) {
+  b->d          = d;
+
+  b->tx_head    = 0;
+  b->tx_tail    = 0;
+  b->rx_head    = 0;
+  b->rx_tail    = 0;
+
+  b->rx_overrun = 0;
+
+  d->ICR        = PL011_INT_RX | PL011_INT_TX | PL011_INT_RT;
+  d->IMSC       = PL011_INT_RX |                PL011_INT_RT;
+}
+
+uint32_t PL011_buf_irq  ( PL011_buf_t* b ) {
+  uint32_t x = b->d->MIS;
+
+  if( x & ( PL011_INT_RX | PL011_INT_RT ) ) {
+    PL011_buf_fill( b );
+    b->d->ICR = PL011_INT_RX | PL011_INT_RT;
+  }
+  if( x & ( PL011_INT_TX                ) ) {
+    b->d->ICR = PL011_INT_TX;
+    PL011_buf_drain( b );
+  }
+
+  return x;
+}
+
+int      PL011_buf_space( PL011_buf_t* b ) {
+  return PL011_RING_SIZE - ( b->tx_head - b->tx_tail );
+}
+
+int      PL011_buf_count( PL011_buf_t* b ) {
+  return                   ( b->rx_head - b->rx_tail );
+}
+
+int      PL011_buf_write( PL011_buf_t* b, const uint8_t* x, int n ) {
+  int r = PL011_buf_space( b );
+
+  if( n < r ) {
+    r = n;
+  }
+
+  for( int i = 0; i < r; i++ ) {
+    b->tx[ b->tx_head++ & ( PL011_RING_SIZE - 1 ) ] = x[ i ];
+  }
+
+  // start transmission now: the TX interrupt only signals the FIFO draining
+  PL011_buf_drain( b );
+
+  return r;
+}
+
+int      PL011_buf_read ( PL011_buf_t* b,       uint8_t* x, int n ) {
+  int r = PL011_buf_count( b );
+
+  if( n < r ) {
+    r = n;
+  }
+
+  for( int i = 0; i < r; i++ ) {
+    x[ i ] = b->rx[ b->rx_tail++ & ( PL011_RING_SIZE - 1 ) ];
+  }
+
+  return r;
+}
+
+int      PL011_buf_find ( PL011_buf_t* b,       uint8_t  x        ) {
+  for( uint32_t i = b->rx_tail; i != b->rx_head; i++ ) {
+    if( b->rx[ i & ( PL011_RING_SIZE - 1 ) ] == x ) {
+      return i - b->rx_tail + 1;
+    }
+  }
+
+  return 0;
+}
@@ -93,4 +93,46 @@ extern void    PL011_puth( PL011_t* d, uint8_t x, bool f );
 // receive  hexified byte r via PL011 instance d (blocking iff. f = true)
 extern uint8_t PL011_geth( PL011_t* d,            bool f );
 
+/* Rather than wait on the FIFOs as above, a buffered PL011 instance pairs
+ * the device with software transmit and receive rings: writes are queued
+ * in the transmit ring and moved into the transmit FIFO by the TX interrupt
+ * as it drains, and the RX (and receive timeout) interrupts move bytes from
+ * the receive FIFO into the receive ring, from which reads are satisfied.
+ * None of the functions below ever block.
+ */
+
+#define PL011_RING_SIZE ( 256 ) // must be a power of 2
+
+#define PL011_INT_RX    ( 0x00000010 )
+#define PL011_INT_TX    ( 0x00000020 )
+#define PL011_INT_RT    ( 0x00000040 )
+
+typedef struct {
+  PL011_t* d;
+
+  uint8_t  tx[ PL011_RING_SIZE ]; // [ tx_tail, tx_head ) is pending transmission
+  uint32_t tx_head, tx_tail;
+  uint8_t  rx[ PL011_RING_SIZE ]; // [ rx_tail, rx_head ) is pending reception
+  uint32_t rx_head, rx_tail;
+
+  uint32_t rx_overrun;            // bytes dropped because the receive ring was full
+} PL011_buf_t;
+
+// initialise buffered instance b of PL011 instance d, enabling RX interrupts
+extern void     PL011_buf_init ( PL011_buf_t* b, PL011_t* d );
+// service an interrupt from b, returning the (masked) interrupt status handled
+extern uint32_t PL011_buf_irq  ( PL011_buf_t* b );
+
+// number of bytes the transmit ring can accept, i.e., write without blocking
+extern int      PL011_buf_space( PL011_buf_t* b );
+// number of bytes the receive  ring holds,      i.e., read  without blocking
+extern int      PL011_buf_count( PL011_buf_t* b );
+
+// queue up to n bytes from x for transmission; return the number queued
+extern int      PL011_buf_write( PL011_buf_t* b, const uint8_t* x, int n );
+// take  up to n bytes into x from the receive ring; return the number taken
+extern int      PL011_buf_read ( PL011_buf_t* b,       uint8_t* x, int n );
+// number of bytes in the receive ring up to and including the first x, or 0
+extern int      PL011_buf_find ( PL011_buf_t* b,       uint8_t  x        );
+
 #endif
@@ -0,0 +1,48 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __VFP_H
+#define __VFP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device.h"
+
+/* The Cortex-A8 implements VFPv3 plus the Advanced SIMD (i.e., NEON)
+ * extension, which share one bank of 32 64-bit registers D0-D31 plus the
+ * FPSCR.  Both are controlled via coprocessors 10 and 11 (Section B1.11 of
+ * the ARMv7-A ARM): CPACR grants access to them, and whilst FPEXC.EN is 0
+ * any VFP or Advanced SIMD instruction raises an undefined instruction
+ * exception instead of executing.
+ */
+
+#define FPEXC_EN 0x40000000
+
+// the VFP state of a process
+typedef struct {
+  uint64_t d[ 32 ];
+  uint32_t fpscr;
+} vfp_t;
+
+// grant access to coprocessors 10 and 11, with FPEXC.EN = 0
+void vfp_init();
+
+//  enable VFP, i.e., set   FPEXC.EN
+void vfp_enable();
+// disable VFP, i.e., clear FPEXC.EN
+void vfp_unable();
+// read FPEXC
+uint32_t vfp_get_fpexc();
+
+// save    D0-D31 and FPSCR into   x (VFP must be enabled)
+void vfp_save( vfp_t* x );
+// restore D0-D31 and FPSCR from   x (VFP must be enabled)
+void vfp_load( vfp_t* x );
+
+#endif
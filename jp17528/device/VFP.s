@@ -0,0 +1,67 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+/* Section B4.1.40 of
+ *
+ * http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.ddi0406c/index.html
+ *
+ * describes CPACR, in which bits 20-23 control access to coprocessors 10
+ * and 11, and Section B6.1.7 describes FPEXC.  The rest of the kernel is
+ * built without VFP support, so the directive below is needed to assemble
+ * the instructions that manage it.
+ */
+
+.fpu neon
+
+.global vfp_init
+
+.global vfp_enable
+.global vfp_unable
+.global vfp_get_fpexc
+
+.global vfp_save
+.global vfp_load
+
+vfp_init:            mrc   p15, 0, r0, c1, c0, 2 @ read  CPACR
+                     orr   r0, r0, #0x00F00000   @ set   CPACR[ cp10 ] = CPACR[ cp11 ] = 11 => full access
+                     mcr   p15, 0, r0, c1, c0, 2 @ write CPACR
+                     isb                         @ synchronise context
+
+                     mov   r0, #0x0
+                     vmsr  fpexc, r0             @ write FPEXC => EN = 0
+
+                     mov   pc, lr                @ return
+
+vfp_enable:          vmrs  r0, fpexc             @ read  FPEXC
+                     orr   r0, r0, #0x40000000   @ set   FPEXC[ EN ] = 1 =>  enable
+                     vmsr  fpexc, r0             @ write FPEXC
+
+                     mov   pc, lr                @ return
+
+vfp_unable:          vmrs  r0, fpexc             @ read  FPEXC
+                     bic   r0, r0, #0x40000000   @ set   FPEXC[ EN ] = 0 => disable
+                     vmsr  fpexc, r0             @ write FPEXC
+
+                     mov   pc, lr                @ return
+
+vfp_get_fpexc:       vmrs  r0, fpexc             @ read  FPEXC
+
+                     mov   pc, lr                @ return
+
+vfp_save:            vstmia r0!, { d0-d15  }     @ save    D0-D15
+                     vstmia r0!, { d16-d31 }     @ save    D16-D31
+                     vmrs  r1, fpscr
+                     str   r1, [ r0 ]            @ save    FPSCR
+
+                     mov   pc, lr                @ return
+
+vfp_load:            vldmia r0!, { d0-d15  }     @ restore D0-D15
+                     vldmia r0!, { d16-d31 }     @ restore D16-D31
+                     ldr   r1, [ r0 ]
+                     vmsr  fpscr, r1             @ restore FPSCR
+
+                     mov   pc, lr                @ return
@@ -1,12 +1,49 @@
 /* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
  *
- * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
- * which can be found via http://creativecommons.org (and should be included as 
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
  * LICENSE.txt within the associated archive or repository).
  */
 
 #include "disk.h"
 
+// the mode in use, once the conf request has been made (see disk_negotiate)
+int  disk_mode  = DISK_MODE_HEX;
+bool disk_ready = false;
+
+// the geometry, once a conf request has been acknowledged (see disk_conf_ack)
+int  disk_num   = DISK_FAILURE;
+int  disk_len   = DISK_FAILURE;
+
+// the conf request disk_negotiate makes, unless the first request is one
+disk_io_t disk_conf_io;
+
+// the request queue, i.e., those sent (so awaiting acknowledgement, in the
+// order sent; the last may still be being sent) then those pending
+disk_io_t* disk_sent_head = NULL;
+disk_io_t* disk_sent_tail = NULL;
+int        disk_sent_num  = 0;
+disk_io_t* disk_pend_head = NULL;
+disk_io_t* disk_pend_tail = NULL;
+
+// the request being sent, and how many bytes of its framing have been
+disk_io_t* disk_tx   = NULL;
+int        disk_tx_i = 0;
+
+// how far the acknowledgement of disk_sent_head has been received: the
+// stage of parsing it is at, the acknowledgement itself, the length of its
+// payload (in binary mode), the number of data bytes so far, and the high
+// nibble of the byte being received (in hex mode)
+int        disk_rx_s = 0;
+uint8_t    disk_rx_r = 0;
+int        disk_rx_n = 0;
+int        disk_rx_i = 0;
+uint8_t    disk_rx_h = 0;
+
+// set once disk_init has been called, and while disk_service is executing
+bool       disk_irq_on = false;
+bool       disk_in     = false;
+
 void addr_puth( PL011_t* d,       uint32_t x,        bool f ) {
   PL011_puth( d, ( x >>  0 ) & 0xFF, f );
   PL011_puth( d, ( x >>  8 ) & 0xFF, f );
@@ -26,96 +63,412 @@ void data_geth( PL011_t* d,       uint8_t* x, int n, bool f ) {
   }
 }
 
-int disk_get_block_num() {
-  int n = 2 * sizeof( uint32_t ); uint8_t x[ n ];
-
-  for( int i = 0; i < DISK_RETRY; i++ ) {
-      PL011_puth( UART2, 0x00, true );        // write command
-      PL011_putc( UART2, '\n', true );        // write EOL
-
-    if( PL011_geth( UART2, true ) == 0x00 ) { // read  command
-      PL011_getc( UART2,       true );        // read  separator
-       data_geth( UART2, x, n, true );        // read  data
-      PL011_getc( UART2,       true );        // read  EOL
-      
-      return ( ( uint32_t )( x[ 0 ] ) <<  0 ) |
-             ( ( uint32_t )( x[ 1 ] ) <<  8 ) |
-             ( ( uint32_t )( x[ 2 ] ) << 16 ) |
-             ( ( uint32_t )( x[ 3 ] ) << 24 ) ;
-    } 
-    else {
-      PL011_getc( UART2,       true );        // read  EOL
-    }
+void data_putb( PL011_t* d, const uint8_t* x, int n, bool f ) {
+  for( int i = 0; i < n; i++ ) {
+    PL011_putc( d, x[ i ], f );
   }
+}
 
-  return DISK_FAILURE;
+static uint32_t word( const uint8_t* x ) {
+  return ( ( uint32_t )( x[ 0 ] ) <<  0 ) |
+         ( ( uint32_t )( x[ 1 ] ) <<  8 ) |
+         ( ( uint32_t )( x[ 2 ] ) << 16 ) |
+         ( ( uint32_t )( x[ 3 ] ) << 24 ) ;
 }
 
-int disk_get_block_len() {
-  int n = 2 * sizeof( uint32_t ); uint8_t x[ n ];
+static void put_word( uint8_t* x, uint32_t y, int n ) {
+  for( int i = 0; i < n; i++ ) {
+    x[ i ] = ( y >> ( 8 * i ) ) & 0xFF;
+  }
+}
 
-  for( int i = 0; i < DISK_RETRY; i++ ) {
-      PL011_puth( UART2, 0x00, true );        // write command
-      PL011_putc( UART2, '\n', true );        // write EOL
+// the i-th byte of the framing of request io, or -1 if it has fewer bytes
+static int  disk_tx_byte( disk_io_t* io, int i ) {
+  if( io->bin ) {
+    int k = io->m + io->n;
 
-    if( PL011_geth( UART2, true ) == 0x00 ) { // read  command
-      PL011_getc( UART2,       true );        // read  separator
-       data_geth( UART2, x, n, true );        // read  data
-      PL011_getc( UART2,       true );        // read  EOL
+    switch( i ) {
+      case 0  : return io->c | DISK_BINARY;                 // command
+      case 1  : return ( k >> 0 ) & 0xFF;                   // length
+      case 2  : return ( k >> 8 ) & 0xFF;
+      default : i -= 3;
+    }
 
-      return ( ( uint32_t )( x[ 4 ] ) <<  0 ) |
-             ( ( uint32_t )( x[ 5 ] ) <<  8 ) |
-             ( ( uint32_t )( x[ 6 ] ) << 16 ) |
-             ( ( uint32_t )( x[ 7 ] ) << 24 ) ;
+    if( i < io->m ) {                                       // header
+      return io->h[ i ];
     }
-    else {
-      PL011_getc( UART2,       true );        // read  EOL
+    if( ( i -= io->m ) < io->n ) {                          // data
+      return io->x[ i ];
+    }
+  }
+  else {
+    if( i < 2 ) {                                           // command
+      return itox( ( io->c >> ( ( i == 0 ) ? 4 : 0 ) ) & 0xF );
+    }
+
+    i -= 2;
+
+    if( io->m > 0 ) {                                       // separator then header
+      if( i-- == 0 ) {
+        return ' ';
+      }
+      if( i < ( 2 * io->m ) ) {
+        return itox( ( io->h[ i >> 1 ] >> ( ( i & 1 ) ? 0 : 4 ) ) & 0xF );
+      }
+
+      i -= 2 * io->m;
+    }
+    if( io->n > 0 ) {                                       // separator then data
+      if( i-- == 0 ) {
+        return ' ';
+      }
+      if( i < ( 2 * io->n ) ) {
+        return itox( ( io->x[ i >> 1 ] >> ( ( i & 1 ) ? 0 : 4 ) ) & 0xF );
+      }
+
+      i -= 2 * io->n;
+    }
+
+    if( i == 0 ) {                                          // EOL
+      return '\n';
+    }
+  }
+
+  return -1;
+}
+
+// a conf request has been acknowledged with r bytes, i.e., the block count
+// and length then (unless the disk is older) the modes it understands: keep
+// them, and use binary mode iff. it and the driver both can
+static void disk_conf_ack( disk_io_t* io, int r ) {
+  if( r >= ( int )( 2 * sizeof( uint32_t ) ) ) {
+    disk_num = word( &io->y[ 0 ] );
+    disk_len = word( &io->y[ 4 ] );
+  }
+  if( r >= ( int )( 3 * sizeof( uint32_t ) ) ) {
+    if( word( &io->y[ 8 ] ) & DISK_MODE & DISK_MODE_BIN ) {
+      disk_mode = DISK_MODE_BIN;
+    }
+  }
+}
+
+// the acknowledgement of io, i.e., disk_sent_head, is complete: take it off
+// the queue, then either re-send or finish it
+static void disk_done( disk_io_t* io ) {
+  int r = DISK_FAILURE;
+
+  if( disk_rx_r == DISK_ACK_OKAY ) {
+    r = ( disk_rx_i < io->k ) ? disk_rx_i : io->k;
+  }
+
+  disk_rx_s = 0;
+  disk_rx_i = 0;
+
+  if( ( disk_sent_head = io->next ) == NULL ) {
+    disk_sent_tail = NULL;
+  }
+
+  disk_sent_num--;
+
+  if( r == DISK_FAILURE && ++io->retry < DISK_RETRY ) {
+    if( ( io->next = disk_pend_head ) == NULL ) {
+      disk_pend_tail = io;
     }
+
+    disk_pend_head = io;
+
+    return;
   }
 
-  return DISK_FAILURE;
+  if( io->c == DISK_REQ_CONF ) {
+    disk_conf_ack( io, r );
+  }
+
+  io->r = r;
+
+  if( io->f != NULL ) {
+    io->f( io );
+  }
 }
 
-int disk_wr( uint32_t a, const uint8_t* x, int n ) {
-  for( int i = 0; i < DISK_RETRY; i++ ) {
-      PL011_puth( UART2, 0x01, true );        // write command
-      PL011_putc( UART2, ' ',  true );        // write separator
-       addr_puth( UART2, a,    true );        // write address
-      PL011_putc( UART2, ' ',  true );        // write separator
-       data_puth( UART2, x, n, true );        // write data
-      PL011_putc( UART2, '\n', true );        // write EOL
-  
-    if( PL011_geth( UART2, true ) == 0x00 ) { // read  command
-      PL011_getc( UART2,       true );        // read  EOL  
+static void disk_rx_data( disk_io_t* io, uint8_t x ) {
+  if( disk_rx_i < io->k ) {
+    io->y[ disk_rx_i ] = x;
+  }
+
+  disk_rx_i++;
+}
+
+// the next byte x of an acknowledgement has been received
+static void disk_rx_byte( uint8_t x ) {
+  disk_io_t* io = disk_sent_head;
+
+  // nothing is awaiting an acknowledgement, so x is noise
+  if( io == NULL ) {
+    return;
+  }
+
+  if( io->bin ) {
+    switch( disk_rx_s++ ) {
+      case 0  : disk_rx_r  = x & ~DISK_BINARY; return;      // acknowledgement
+      case 1  : disk_rx_n  = x << 0;           return;      // length
+      case 2  : disk_rx_n |= x << 8;           break;
+      default : disk_rx_data( io, x );         break;       // data
+    }
 
-      return DISK_SUCCESS;
+    if( disk_rx_i == disk_rx_n ) {
+      disk_done( io );
     }
-    else {
-      PL011_getc( UART2,       true );        // read  EOL
+  }
+  else {
+    switch( disk_rx_s ) {
+      case 0  :                                             // acknowledgement
+        disk_rx_r  = xtoi( x ) << 4; disk_rx_s = 1;
+        break;
+      case 1  :
+        disk_rx_r |= xtoi( x ) << 0; disk_rx_s = 2;
+        break;
+      case 2  :                                             // separator, EOL or data
+        if     ( x == '\n' ) {
+          disk_done( io );
+        }
+        else if( x != ' '  ) {
+          disk_rx_h  = xtoi( x );      disk_rx_s = 3;
+        }
+        break;
+      case 3  :
+        disk_rx_data( io, ( disk_rx_h << 4 ) | xtoi( x ) );
+        disk_rx_s = 2;
+        break;
     }
   }
-  
-  return DISK_FAILURE;
 }
 
-int disk_rd( uint32_t a,       uint8_t* x, int n ) {
-  for( int i = 0; i < DISK_RETRY; i++ ) {
-      PL011_puth( UART2, 0x02, true );        // write command
-      PL011_putc( UART2, ' ',  true );        // write separator
-       addr_puth( UART2, a,    true );        // write address
-      PL011_putc( UART2, '\n', true );        // write EOL
-  
-    if( PL011_geth( UART2, true ) == 0x00 ) { // read  command
-      PL011_getc( UART2,       true );        // read  separator
-       data_geth( UART2, x, n, true );        // read  data
-      PL011_getc( UART2,       true );        // read  EOL
+// move the request queue along as far as UART2 allows without waiting: take
+// whatever has been received, then send whatever can be
+static void disk_service() {
+  // a request finishing (i.e., io->f) may submit another, which is then sent
+  // below rather than via a nested call
+  if( disk_in ) {
+    return;
+  }
+
+  disk_in = true;
+
+  while( PL011_can_getc( UART2 ) ) {
+    disk_rx_byte( PL011_getc( UART2, false ) );
+  }
+
+  while( PL011_can_putc( UART2 ) ) {
+    if( disk_tx == NULL ) {
+      disk_io_t* io = disk_pend_head;
+
+      if( io == NULL || disk_sent_num == DISK_DEPTH ) {
+        break;
+      }
 
-      return DISK_SUCCESS;
+      if( ( disk_pend_head = io->next ) == NULL ) {
+        disk_pend_tail = NULL;
+      }
+
+      io->next = NULL;
+
+      if( disk_sent_tail != NULL ) {
+        disk_sent_tail->next = io;
+      }
+      else {
+        disk_sent_head       = io;
+      }
+
+      disk_sent_tail = io; disk_sent_num++;
+
+      // decide the framing now rather than in disk_submit, since the conf
+      // request (which may switch to binary mode) may since have finished
+      io->bin   = ( disk_mode == DISK_MODE_BIN );
+
+      disk_tx   = io;
+      disk_tx_i = 0;
+    }
+
+    int x = disk_tx_byte( disk_tx, disk_tx_i++ );
+
+    if( x < 0 ) {
+      disk_tx = NULL;
     }
     else {
-      PL011_getc( UART2,       true );        // read  EOL
+      PL011_putc( UART2, x, false );
     }
   }
 
-  return DISK_FAILURE;
+  if( disk_irq_on ) {
+    if( disk_tx != NULL || ( disk_pend_head != NULL && disk_sent_num < DISK_DEPTH ) ) {
+      UART2->IMSC |=  PL011_INT_TX; // more to send: interrupt once the FIFO drains
+    }
+    else {
+      UART2->IMSC &= ~PL011_INT_TX; // nothing to send: no need to interrupt
+    }
+  }
+
+  disk_in = false;
+}
+
+static void disk_enqueue( disk_io_t* io ) {
+  io->r     = DISK_BUSY;
+  io->retry = 0;
+  io->next  = NULL;
+
+  if( disk_pend_tail != NULL ) {
+    disk_pend_tail->next = io;
+  }
+  else {
+    disk_pend_head       = io;
+  }
+
+  disk_pend_tail = io;
+}
+
+// query the disk (in hex mode) ahead of io, the first request, unless io does
+// so itself: the acknowledgement is dealt with by disk_conf_ack
+static void disk_negotiate( disk_io_t* io );
+
+void disk_submit( disk_io_t* io ) {
+  if( !disk_ready ) {
+    disk_negotiate( io );
+  }
+
+  disk_enqueue( io );
+
+  disk_service();
+}
+
+// submit io, then poll UART2 until it is finished (so this must not be used
+// by io->f); return io->r
+static int  disk_wait( disk_io_t* io ) {
+  disk_submit( io );
+
+  while( io->r == DISK_BUSY ) {
+    disk_service();
+  }
+
+  return io->r;
+}
+
+// prepare io as request c, with m bytes of header (already in io->h), n
+// bytes of data x to send, and room for k bytes of data back in y
+static void disk_io( disk_io_t* io, uint8_t c, int m, const uint8_t* x, int n, uint8_t* y, int k ) {
+  io->c   = c;
+  io->m   = m;
+  io->x   = x;
+  io->n   = n;
+  io->y   = y;
+  io->k   = k;
+
+  io->f   = NULL;
+  io->arg = NULL;
+}
+
+void disk_io_conf( disk_io_t* io ) {
+  // the header is not sent (since m = 0), so has room for the acknowledgement
+  disk_io( io, DISK_REQ_CONF, 0, NULL, 0, io->h, 3 * sizeof( uint32_t ) );
+}
+
+static void disk_negotiate( disk_io_t* io ) {
+  disk_ready = true;
+
+  if( io->c != DISK_REQ_CONF ) {
+    disk_io_conf( &disk_conf_io ); disk_enqueue( &disk_conf_io );
+  }
+}
+
+// make a conf request, unless one has been acknowledged already
+static void disk_conf() {
+  disk_io_t io;
+
+  if( disk_num == DISK_FAILURE ) {
+    disk_io_conf( &io ); disk_wait( &io );
+  }
+}
+
+int disk_get_block_num() {
+  disk_conf();
+
+  return disk_num;
+}
+
+int disk_get_block_len() {
+  disk_conf();
+
+  return disk_len;
+}
+
+// encode the m extents e as a header, i.e., m as a 16-bit integer then each
+// address and length in turn (as 32- and 16-bit integers), into h; return
+// the number of blocks they cover, or DISK_FAILURE if there are too many
+static int  disk_extents( uint8_t* h, const disk_ext_t* e, int m ) {
+  int k = 0;
+
+  if( m <= 0 || m > DISK_VEC_MAX ) {
+    return DISK_FAILURE;
+  }
+
+  put_word( h, m, 2 ); h += 2;
+
+  for( int i = 0; i < m; i++, h += 6 ) {
+    put_word( &h[ 0 ], e[ i ].a, 4 );
+    put_word( &h[ 4 ], e[ i ].n, 2 );
+
+    k += e[ i ].n;
+  }
+
+  return k;
+}
+
+void disk_io_wr ( disk_io_t* io, uint32_t a, const uint8_t* x, int n ) {
+  put_word( io->h, a, 4 );
+
+  disk_io( io, DISK_REQ_WR, 4, x, n, NULL, 0 );
+}
+
+void disk_io_rd ( disk_io_t* io, uint32_t a,       uint8_t* x, int n ) {
+  put_word( io->h, a, 4 );
+
+  disk_io( io, DISK_REQ_RD, 4, NULL, 0, x, n );
+}
+
+int  disk_io_wrv( disk_io_t* io, const disk_ext_t* e, int m, const uint8_t* x, int n ) {
+  int k = disk_extents( io->h, e, m );
+
+  if( k == DISK_FAILURE || ( k * n ) > DISK_VEC_LEN ) {
+    return DISK_FAILURE;
+  }
+
+  disk_io( io, DISK_REQ_WRV, 2 + 6 * m, x, k * n, NULL, 0 );
+
+  return DISK_SUCCESS;
+}
+
+int  disk_io_rdv( disk_io_t* io, const disk_ext_t* e, int m,       uint8_t* x, int n ) {
+  int k = disk_extents( io->h, e, m );
+
+  if( k == DISK_FAILURE || ( k * n ) > DISK_VEC_LEN ) {
+    return DISK_FAILURE;
+  }
+
+  disk_io( io, DISK_REQ_RDV, 2 + 6 * m, NULL, 0, x, k * n );
+
+  return DISK_SUCCESS;
+}
+
+void disk_init() {
+  disk_irq_on = true;
+
+  UART2->ICR  = PL011_INT_RX | PL011_INT_TX | PL011_INT_RT;
+  UART2->IMSC = PL011_INT_RX |                PL011_INT_RT;
+}
+
+void disk_irq() {
+  // clear first, so anything that arrives while servicing interrupts again
+  UART2->ICR  = PL011_INT_RX | PL011_INT_TX | PL011_INT_RT;
+
+  disk_service();
 }
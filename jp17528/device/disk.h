@@ -1,7 +1,7 @@
 /* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
  *
- * Use of this source code is restricted per the CC BY-NC-ND license, a copy of 
- * which can be found via http://creativecommons.org (and should be included as 
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
  * LICENSE.txt within the associated archive or repository).
  */
 
@@ -15,9 +15,9 @@
 #include "PL011.h"
 
 /* Each of the following functions adopts the same approach to
- * reporting success vs. failure, as indicated by the response 
+ * reporting success vs. failure, as indicated by the response
  * produced by the disk: they return an r st.
- * 
+ *
  * r <  0 means failure
  * r >= 0 means success
  *
@@ -30,14 +30,144 @@
 #define DISK_SUCCESS (  0 )
 #define DISK_FAILURE ( -1 )
 
+/* Requests and acknowledgements are framed in one of two ways:
+ *
+ * - hex mode, which every disk understands, sends a line of space
+ *   separated fields, each byte of which is written as two hex
+ *   characters, e.g., "02 78563412\n" to read block 0x12345678;
+ * - binary mode sends a frame, i.e., a 3-byte header (the command
+ *   or acknowledgement with DISK_BINARY set, then the length of
+ *   the payload as a 16-bit little-endian integer) followed by the
+ *   payload itself, raw.  The payload is the same fields as the
+ *   line would hold, back to back.
+ *
+ * Binary mode moves each byte as one character rather than two
+ * (plus separators), so more or less doubles throughput.  Since
+ * the first byte of a frame has bit 7 set, whereas a line starts
+ * with a hex character, the disk can tell which one a request is
+ * and acknowledges it in kind; there is no mode to get out of step.
+ *
+ * The driver starts in hex mode, and switches to binary mode iff.
+ * the conf request advertises it (i.e., the modes field it sends
+ * after the block count and length includes DISK_MODE_BIN) and it
+ * is built with DISK_MODE set to match (see below); older disks
+ * send no modes field, so are only ever spoken to in hex.
+ */
+
+#define DISK_MODE_HEX ( 0x01 )
+#define DISK_MODE_BIN ( 0x02 )
+
+// the mode(s) the driver may use
+#ifndef DISK_MODE
+#define DISK_MODE ( DISK_MODE_HEX | DISK_MODE_BIN )
+#endif
+
+#define DISK_BINARY   ( 0x80 )
+
+#define DISK_REQ_CONF ( 0x00 )
+#define DISK_REQ_WR   ( 0x01 )
+#define DISK_REQ_RD   ( 0x02 )
+#define DISK_REQ_RDV  ( 0x03 )
+#define DISK_REQ_WRV  ( 0x04 )
+
+#define DISK_ACK_OKAY ( 0x00 )
+#define DISK_ACK_FAIL ( 0x01 )
+
 // query the disk block count
 extern int disk_get_block_num();
 // query the disk block length
 extern int disk_get_block_len();
 
-// write an n-byte block of data x to   the disk at block address a
-extern int disk_wr( uint32_t a, const uint8_t* x, int n );
-// read  an n-byte block of data x from the disk at block address a
-extern int disk_rd( uint32_t a,       uint8_t* x, int n );
+/* The driver keeps the geometry (and mode) from the first conf request that
+ * is acknowledged, so the functions above only make one if none has been.
+ * The first request submitted is always preceded by one, unless it is one.
+ *
+ * Besides the conf request, the disk takes requests to write or read an
+ * n-byte block of data x to or from block address a, and the vectored
+ * requests below.
+ */
+
+/* The vectored requests move any number of blocks in one exchange,
+ * rather than one per round trip: they take a list of extents, each
+ * a run of contiguous blocks, so cover a single run and a scatter
+ * list (of runs of 1 block) alike.  The data for the blocks is back
+ * to back in x, in the order the extents list them.  At most
+ * DISK_VEC_MAX extents, and DISK_VEC_LEN bytes, fit in one request.
+ * Older disks do not know them, so answer DISK_ACK_FAIL.
+ */
+
+#define DISK_VEC_MAX  (     64 )
+#define DISK_VEC_LEN  ( 0x8000 )
+
+typedef struct {
+  uint32_t a; // first block address
+  uint16_t n; // number of blocks
+} disk_ext_t;
+
+/* disk_get_block_num and disk_get_block_len make their request (if any)
+ * then wait for the disk, polling UART2, so the processor does nothing else
+ * until the acknowledgement arrives.  Every other request is made
+ * asynchronously:
+ *
+ * 1. disk_io_rd (etc.) prepares it in a disk_io_t,
+ * 2. disk_submit appends it to the request queue, then
+ * 3. once it is acknowledged, the driver sets io->r to the result (i.e.,
+ *    as above: DISK_FAILURE, or the number of bytes of data the disk sent
+ *    back, so the request succeeded iff. io->r == io->k) and calls io->f,
+ *    if set.  Until then, io->r is DISK_BUSY, and neither io nor the data
+ *    it points at may be touched.
+ *
+ * Once disk_init has been called, the queue is serviced by the UART2 RX and
+ * TX interrupts (i.e., disk_irq), so io->f is called from the interrupt
+ * handler.  Since the disk acknowledges requests strictly in order, up to
+ * DISK_DEPTH of them are sent without waiting for the acknowledgement of
+ * those before; a request that fails is re-sent (up to DISK_RETRY times)
+ * ahead of any not yet sent, but after any already in flight.
+ */
+
+#define DISK_BUSY     (     -2 )
+#define DISK_DEPTH    (      4 )
+
+// the longest header a request has, i.e., that of a vectored request
+#define DISK_HDR_LEN  ( 2 + 6 * DISK_VEC_MAX )
+
+typedef struct disk_io_t {
+  uint8_t        c;                    // request, i.e., DISK_REQ_...
+  uint8_t        h[ DISK_HDR_LEN ];    // header, e.g., the block address
+  int            m;
+  const uint8_t* x;                    // data to send
+  int            n;
+  uint8_t*       y;                    // room for the data sent back
+  int            k;
+
+  volatile int   r;                    // result, or DISK_BUSY
+  void         (*f)( struct disk_io_t* io );
+  void*          arg;                  // for use by f
+
+  bool           bin;                  // framed in binary mode
+  int            retry;
+  struct disk_io_t* next;
+} disk_io_t;
+
+// prepare io as a conf request, i.e., per disk_get_block_num (etc.): once
+// it finishes, they return what the disk sent back without another request
+extern void disk_io_conf( disk_io_t* io );
+// prepare io to write or read an n-byte block of data x to or from the disk
+// at block address a
+extern void disk_io_wr ( disk_io_t* io, uint32_t a, const uint8_t* x, int n );
+extern void disk_io_rd ( disk_io_t* io, uint32_t a,       uint8_t* x, int n );
+// prepare io to write or read n-byte blocks of data x to or from the disk
+// at the m extents e; return DISK_FAILURE if the request is too large, else
+// DISK_SUCCESS
+extern int  disk_io_wrv( disk_io_t* io, const disk_ext_t* e, int m, const uint8_t* x, int n );
+extern int  disk_io_rdv( disk_io_t* io, const disk_ext_t* e, int m,       uint8_t* x, int n );
+
+// append the prepared request io to the request queue
+extern void disk_submit( disk_io_t* io );
+
+// service the request queue from the UART2 interrupts from now on
+extern void disk_init();
+// handle a UART2 interrupt
+extern void disk_irq();
 
 #endif
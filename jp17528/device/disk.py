@@ -6,19 +6,42 @@
 
 import argparse, binascii, logging, os, socket, struct, sys
 
-REQ_CONF = '00'
-REQ_WR   = '01'
-REQ_RD   = '02'
+REQ_CONF = 0x00
+REQ_WR   = 0x01
+REQ_RD   = 0x02
+REQ_RDV  = 0x03
+REQ_WRV  = 0x04
 
-ACK_OKAY = '00'
-ACK_FAIL = '01'
+ACK_OKAY = 0x00
+ACK_FAIL = 0x01
+
+# Requests arrive framed in one of two ways (see disk.h), and each
+# acknowledgement is framed the same way as the request it answers:
+#
+# - in hex mode, a request is a line of space separated fields, with
+#   each byte written as two hex characters;
+# - in binary mode, it is a frame: the command with BINARY set, the
+#   length of the payload (16-bit, little-endian), then the payload,
+#   i.e., the same fields back to back, raw.
+#
+# The first byte tells them apart, since no hex character has bit 7
+# set.  Either way, a request is parsed into a list of the command
+# then its fields (as raw bytes) before it is processed, and fields
+# are split out of a binary payload per the command.
+
+BINARY   = 0x80
+
+MODE_HEX = 0x01
+MODE_BIN = 0x02
 
 # 00 command means a query operation: we pack the block size 
-# and count into a single datum, then return it.
+# and count into a single datum, then return it along with the
+# modes (i.e., framings) we support.
 
 def conf( fd, req ) :
   data  = struct.pack( '<l', args.block_num )
   data += struct.pack( '<l', args.block_len )
+  data += struct.pack( '<l', MODE_HEX | MODE_BIN )
 
   return [ ACK_OKAY, data ]
 
@@ -28,8 +51,11 @@ def conf( fd, req ) :
 # - else write the block to   the disk, then flush  the data.
 
 def   wr( fd, req ) :
-  address = struct.unpack( '<l', binascii.unhexlify( req[ 1 ] ) )[ 0 ]
-  data    =                      binascii.unhexlify( req[ 2 ] )
+  if( len( req ) != 3 or len( req[ 1 ] ) != 4 ) :
+    return [ ACK_FAIL ]
+
+  address = struct.unpack( '<l', req[ 1 ] )[ 0 ]
+  data    =                      req[ 2 ]
 
   if( address     >= args.block_num ) :
     return [ ACK_FAIL ]
@@ -54,7 +80,10 @@ def   wr( fd, req ) :
 # - else read  the block from the disk, then return the data.
 
 def   rd( fd, req ) :
-  address = struct.unpack( '<l', binascii.unhexlify( req[ 1 ] ) )[ 0 ]
+  if( len( req ) <  2 or len( req[ 1 ] ) != 4 ) :
+    return [ ACK_FAIL ]
+
+  address = struct.unpack( '<l', req[ 1 ] )[ 0 ]
 
   if( address     >= args.block_num ) :
     return [ ACK_FAIL ]
@@ -65,17 +94,152 @@ def   rd( fd, req ) :
   if( len( data ) != args.block_len ) :
     return [ ACK_FAIL ]
 
-  os.fsync( fd )
-
   logging.info( 'rd %d bytes <- address %X_{(16)} = %d_{(10)}' % ( len( data ), address, address ) )
   logging.debug( 'rd data = %s' % ( ''.join( [ '%02X' % ( ord( x ) ) for x in data ] ) ) )
 
   return [ ACK_OKAY, data ]
 
+# A vectored request starts with a list of extents, i.e., how many
+# there are (16-bit) then the address (32-bit) and length in blocks
+# (16-bit) of each; parse one into a list of [ address, length ], or
+# None if it is malformed or any extent lies outside the disk.
+
+def extents( x ) :
+  if( len( x ) < 2 ) :
+    return None
+
+  m = struct.unpack( '<H', x[ 0 : 2 ] )[ 0 ]
+
+  if( len( x ) != 2 + 6 * m ) :
+    return None
+
+  r = []
+
+  for i in range( m ) :
+    [ address, n ] = struct.unpack( '<lH', x[ 2 + 6 * i : 8 + 6 * i ] )
+
+    if( address < 0 or n == 0 or address + n > args.block_num ) :
+      return None
+
+    r.append( [ address, n ] )
+
+  return r
+
+# 03 command means a vectored read  operation:
+# - if any extent provided is invalid the request fails,
+# - else read  the blocks of each extent from the disk in turn, then
+#   return all the data at once.
+
+def  rdv( fd, req ) :
+  e = extents( req[ 1 ] ) if ( len( req ) >= 2 ) else None
+
+  if( e == None ) :
+    return [ ACK_FAIL ]
+
+  data = ''
+
+  for [ address, n ] in e :
+    os.lseek( fd, address * args.block_len, os.SEEK_SET )
+    t = os.read( fd, n * args.block_len )
+
+    if( len( t ) != n * args.block_len ) :
+      return [ ACK_FAIL ]
+
+    data += t
+
+  logging.info( 'rd %d bytes <- %d extent(s)' % ( len( data ), len( e ) ) )
+  logging.debug( 'rd data = %s' % ( ''.join( [ '%02X' % ( ord( x ) ) for x in data ] ) ) )
+
+  return [ ACK_OKAY, data ]
+
+# 04 command means a vectored write operation:
+# - if any extent provided is invalid the request fails,
+# - if the data    provided does not cover every block the request fails,
+# - else write the blocks of each extent to   the disk in turn, then
+#   flush the data (once, for all of them).
+
+def  wrv( fd, req ) :
+  e = extents( req[ 1 ] ) if ( len( req ) == 3 ) else None
+
+  if( e == None ) :
+    return [ ACK_FAIL ]
+
+  data = req[ 2 ]
+
+  if( len( data ) != sum( [ n for [ address, n ] in e ] ) * args.block_len ) :
+    return [ ACK_FAIL ]
+
+  i = 0
+
+  for [ address, n ] in e :
+    os.lseek( fd, address * args.block_len, os.SEEK_SET )
+
+    if( os.write( fd, data[ i : i + n * args.block_len ] ) != n * args.block_len ) :
+      return [ ACK_FAIL ]
+
+    i += n * args.block_len
+
+  os.fsync( fd )
+
+  logging.info( 'wr %d bytes -> %d extent(s)' % ( len( data ), len( e ) ) )
+  logging.debug( 'wr data = %s' % ( ''.join( [ '%02X' % ( ord( x ) ) for x in data ] ) ) )
+
+  return [ ACK_OKAY       ]
+
+# read a request in either framing, returning it parsed plus whether
+# it was binary
+
+def req_read( sd ) :
+  x = sd.read( 1 )
+
+  if ( x == '' ) :
+    return [ None, False ]
+
+  if ( ord( x ) & BINARY ) :
+    n = struct.unpack( '<H', sd.read( 2 ) )[ 0 ]
+    y = sd.read( n )
+    c = ord( x ) & ~BINARY
+
+    # the payload is an address or extents, then data, for those commands
+    # with one
+    if   ( c == REQ_WR  or c == REQ_RD  ) :
+      req = [ c, y[ 0 : 4 ], y[ 4 : ] ]
+    elif ( c == REQ_WRV or c == REQ_RDV ) and ( len( y ) >= 2 ) :
+      k   = 2 + 6 * struct.unpack( '<H', y[ 0 : 2 ] )[ 0 ]
+      req = [ c, y[ 0 : k ], y[ k : ] ]
+    else :
+      req = [ c ]
+
+    return [ req, True ]
+  else :
+    req = ( x + sd.readline() ).strip().split( ' ' )
+
+    try :
+      req = [ int( req[ 0 ], 16 ) ] + [ binascii.unhexlify( f ) for f in req[ 1 : ] ]
+    except ( ValueError, TypeError ) :
+      req = [ None ]
+
+    return [ req, False ]
+
+# write an acknowledgement, framed like the request it answers
+
+def ack_write( sd, ack, binary ) :
+  if ( binary ) :
+    data = ''.join( ack[ 1 : ] )
+    sd.write( chr( ack[ 0 ] | BINARY ) + struct.pack( '<H', len( data ) ) + data )
+  elif ( len( ack ) > 1 ) :
+    sd.write( '%02X' % ( ack[ 0 ] ) + ' ' + ' '.join( [ binascii.hexlify( x ) for x in ack[ 1 : ] ] ) + '\n' )
+  else :
+    sd.write( '%02X' % ( ack[ 0 ] ) + '\n' )
+
+  sd.flush()
+
 # The command line interface basically just parses the arguments
 # which configure the disk etc. then enters an infinite loop: it
 # reads requests and writes acknowledgements one at a time until
-# terminated.
+# terminated.  Requests are acknowledged strictly in the order they
+# arrive, which is what lets the driver pipeline them, i.e., send
+# several before the first is acknowledged.
 
 if ( __name__ == '__main__' ) :
   # parse command line arguments
@@ -113,9 +277,12 @@ if ( __name__ == '__main__' ) :
   # read request, process it and write acknowledgement
   
   while ( True ) :
-    req = sd.readline().strip().split( ' ' )
+    [ req, binary ] = req_read( sd )
+
+    if ( req == None ) :
+      break
 
-    logging.debug( 'req = ' + str( req ) )  
+    logging.debug( 'req = ' + str( req ) + ( ' (binary)' if binary else ' (hex)' ) )
   
     if   ( req[ 0 ] == REQ_CONF ) :
       ack = conf( fd, req )
@@ -123,17 +290,16 @@ if ( __name__ == '__main__' ) :
       ack =   wr( fd, req )
     elif ( req[ 0 ] == REQ_RD   ) :
       ack =   rd( fd, req )
+    elif ( req[ 0 ] == REQ_RDV  ) :
+      ack =  rdv( fd, req )
+    elif ( req[ 0 ] == REQ_WRV  ) :
+      ack =  wrv( fd, req )
     else :
       ack = [ ACK_FAIL ]
 
     logging.debug( 'ack = ' + str( ack ) )
 
-    if ( len( ack ) > 1 ) :
-      ack = ack[ 0 ] + ' ' + ' '.join( [ binascii.hexlify( x ) for x in ack[ 1 : ] ] )
-    else :
-      ack = ack[ 0 ]
-
-    sd.write( ack + '\n' ) ; sd.flush()
+    ack_write( sd, ack, binary )
   
   # close network connection
 
@@ -0,0 +1,719 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "bcache.h"
+
+buf_t    bcacheTab [ BCACHE_BUFS ];
+buf_t*   bcacheHash[ BCACHE_HASH ];
+
+// the LRU list, from the most (head) to the least (tail) recently used
+buf_t*   bcacheHead = NULL;
+buf_t*   bcacheTail = NULL;
+
+// disk geometry, and the number of buffers set up; 0 until first use
+uint32_t bcacheNum  = 0;
+uint32_t bcacheLen  = 0;
+uint32_t bcacheBufs = 0;
+
+// the number of blocks a batch can hold, and whether the disk takes the
+// vectored requests that move more than one
+int       bcacheBatchMax = 0;
+bool      bcacheVec      = false;
+
+// a flush, i.e., dirty buffers (in order of address) being written back
+batch_t   bcacheFlush;
+bool      bcacheFlushFail = false;
+
+// the sequential streams being read, and the blocks being read ahead
+stream_t  bcacheStream[ BCACHE_STREAMS ];
+uint32_t  bcacheStreamClock = 0;
+batch_t   bcacheFetch [ BCACHE_RA_IOS  ];
+
+// the single-buffer requests, and the processes waiting for one to be free
+bio_t     bcacheBio   [ BCACHE_IOS     ];
+queue_t   bcacheBioQ  = { NULL, NULL };
+
+// processes in SYS_SYNC, waiting for a flush to finish
+queue_t   bcacheSyncQ = { NULL, NULL };
+
+// the requests that ask the disk what it is (see bcache_init), how many of
+// them are in flight, and the processes waiting for them to finish
+disk_io_t bcacheProbe[ 2 ];
+int       bcacheProbing = 0;
+bool      bcacheProbed  = false;
+queue_t   bcacheProbeQ  = { NULL, NULL };
+
+uint32_t bcacheUsed = 0, bcacheDirty = 0;
+uint32_t bcacheHits = 0, bcacheMisses = 0, bcacheWritebacks = 0;
+uint32_t bcacheReadaheads = 0;
+
+static void lru_remove( buf_t* b ) {
+  if( b->prev != NULL ) {
+    b->prev->next = b->next;
+  }
+  else {
+    bcacheHead    = b->next;
+  }
+
+  if( b->next != NULL ) {
+    b->next->prev = b->prev;
+  }
+  else {
+    bcacheTail    = b->prev;
+  }
+}
+
+static void lru_push( buf_t* b ) {
+  b->prev = NULL;
+  b->next = bcacheHead;
+
+  if( bcacheHead != NULL ) {
+    bcacheHead->prev = b;
+  }
+  else {
+    bcacheTail       = b;
+  }
+
+  bcacheHead = b;
+}
+
+static buf_t** hash_bucket( uint32_t a ) {
+  return &bcacheHash[ a & ( BCACHE_HASH - 1 ) ];
+}
+
+static void hash_remove( buf_t* b ) {
+  buf_t** t = hash_bucket( b->a );
+
+  while( *t != b ) {
+    t = &( *t )->hash;
+  }
+
+  *t = b->hash;
+}
+
+static bool batch_init( batch_t* t ) {
+  if( t->stage == NULL && ( t->stage = kpage_alloc() ) == NULL ) {
+    return false;
+  }
+
+  t->busy = false;
+
+  return true;
+}
+
+// prepare t->io to write (c = DISK_REQ_WR) or read (c = DISK_REQ_RD) the k
+// extents e to or from the stage: a single block goes as a plain request,
+// which also means a batch can be used if the disk has no vectored ones
+static void batch_io( batch_t* t, uint8_t c, disk_ext_t* e, int k ) {
+  if( k == 1 && e[ 0 ].n == 1 ) {
+    if( c == DISK_REQ_WR ) {
+      disk_io_wr ( &t->io, e[ 0 ].a, t->stage, bcacheLen );
+    }
+    else {
+      disk_io_rd ( &t->io, e[ 0 ].a, t->stage, bcacheLen );
+    }
+  }
+  else {
+    if( c == DISK_REQ_WR ) {
+      disk_io_wrv( &t->io, e, k, t->stage, bcacheLen );
+    }
+    else {
+      disk_io_rdv( &t->io, e, k, t->stage, bcacheLen );
+    }
+  }
+}
+
+static void bcache_probed( disk_io_t* io ) {
+  if( --bcacheProbing == 0 ) {
+    wake_all( &bcacheProbeQ );
+  }
+}
+
+int  bcache_init ( queue_t** q ) {
+  if( bcacheBufs > 0 ) {
+    return DISK_SUCCESS;
+  }
+
+  // ask the disk for its geometry, plus whether it takes vectored requests
+  // (via one that reads block 0 but keeps none of it, which an older disk
+  // fails), unless already doing so: the caller waits for the answers as it
+  // would for a miss
+  if( !bcacheProbed ) {
+    disk_ext_t e = { 0, 1 };
+
+    disk_io_conf( &bcacheProbe[ 0 ] );
+    disk_io_rdv ( &bcacheProbe[ 1 ], &e, 1, NULL, 0 );
+
+    bcacheProbed  = true;
+    bcacheProbing = 2;
+
+    for( int i = 0; i < 2; i++ ) {
+      bcacheProbe[ i ].f = bcache_probed; disk_submit( &bcacheProbe[ i ] );
+    }
+  }
+
+  if( bcacheProbing > 0 ) {
+    *q = &bcacheProbeQ; return BCACHE_AGAIN;
+  }
+
+  // it failed: the next use asks again
+  if( bcacheProbe[ 0 ].r < ( int )( 2 * sizeof( uint32_t ) ) ) {
+    bcacheProbed = false; return DISK_FAILURE;
+  }
+
+  bcacheVec = ( bcacheProbe[ 1 ].r != DISK_FAILURE );
+
+  int n = disk_get_block_num();
+  int m = disk_get_block_len();
+
+  if( n <= 0 || m <= 0 || m > KPAGE_SIZE || !batch_init( &bcacheFlush ) ) {
+    return DISK_FAILURE;
+  }
+
+  for( int i = 0; i < BCACHE_RA_IOS; i++ ) {
+    if( !batch_init( &bcacheFetch[ i ] ) ) {
+      return DISK_FAILURE;
+    }
+  }
+
+  // a batch fills a page, bar that it must fit in one request: without
+  // vectored requests, that means one block, which goes as a plain request
+  bcacheBatchMax = KPAGE_SIZE / m;
+
+  if( bcacheBatchMax > DISK_VEC_MAX ) {
+    bcacheBatchMax = DISK_VEC_MAX;
+  }
+  if( !bcacheVec ) {
+    bcacheBatchMax = 1;
+  }
+
+  // i.e., so that no read is taken as following on from ->last
+  for( int i = 0; i < BCACHE_STREAMS; i++ ) {
+    bcacheStream[ i ].last  = UINT32_MAX - 1;
+    bcacheStream[ i ].win   = 0;
+    bcacheStream[ i ].stamp = 0;
+  }
+
+  for( int i = 0; i < BCACHE_HASH; i++ ) {
+    bcacheHash[ i ] = NULL;
+  }
+
+  for( int i = 0; i < BCACHE_BUFS; i++ ) {
+    buf_t* b = &bcacheTab[ i ];
+
+    if( ( b->data = kmalloc( m ) ) == NULL ) {
+      break;
+    }
+
+    b->used    = false;
+    b->busy    = false;
+    b->wq.head = NULL;
+    b->wq.tail = NULL;
+
+    lru_push( b ); bcacheBufs++;
+  }
+
+  bcacheNum = n;
+  bcacheLen = m;
+
+  return ( bcacheBufs > 0 ) ? DISK_SUCCESS : DISK_FAILURE;
+}
+
+static buf_t* bcache_find( uint32_t a ) {
+  for( buf_t* b = *hash_bucket( a ); b != NULL; b = b->hash ) {
+    if( b->a == a ) {
+      return b;
+    }
+  }
+
+  return NULL;
+}
+
+// b no longer holds any block
+static void bcache_drop( buf_t* b ) {
+  if( b->used ) {
+    hash_remove( b ); b->used = false; bcacheUsed--;
+  }
+}
+
+// a free single-buffer request, or NULL (and, in q, the queue to wait on
+// until one is) if they are all in flight
+static bio_t* bcache_bio( queue_t** q ) {
+  for( int i = 0; i < BCACHE_IOS; i++ ) {
+    if( !bcacheBio[ i ].busy ) {
+      return &bcacheBio[ i ];
+    }
+  }
+
+  *q = &bcacheBioQ; return NULL;
+}
+
+// the I/O of a buffer alone, i.e., reading it in or writing it back, has
+// finished
+static void bcache_done( disk_io_t* io ) {
+  bio_t* t  = ( bio_t* )( io->arg );
+  buf_t* b  = t->buf;
+  bool   ok = ( io->r == io->k );
+
+  t->busy  = false;
+
+  b->busy  = false;
+  b->error = !ok;
+
+  if( ok && io->c == DISK_REQ_RD ) {
+    b->valid = true;
+    b->fresh = true;
+  }
+  if( ok && io->c == DISK_REQ_WR ) {
+    b->dirty = false; bcacheDirty--; bcacheWritebacks++;
+  }
+
+  wake_all( &b->wq );
+  wake_all( &bcacheBioQ );
+}
+
+// submit t->io, which moves b alone
+static void bcache_io( bio_t* t, buf_t* b ) {
+  t->io.f   = bcache_done;
+  t->io.arg = t;
+  t->buf    = b;
+  t->busy   = true;
+  b->busy   = true;
+
+  disk_submit( &t->io );
+}
+
+// assign a buffer to block a, which is not cached: the least recently used
+// one that is not busy, once written back if it is dirty.  Return it, or
+// NULL and either DISK_FAILURE or BCACHE_AGAIN (and q) in *r
+static buf_t* bcache_claim( uint32_t a, int* r, queue_t** q ) {
+  buf_t* b = bcacheTail;
+
+  while( b != NULL && b->busy ) {
+    b = b->prev;
+  }
+
+  // everything is busy: wait for the least recently used buffer
+  if( b == NULL ) {
+    *q = &bcacheTail->wq; *r = BCACHE_AGAIN; return NULL;
+  }
+
+  if( b->used && b->dirty ) {
+    bio_t* t;
+
+    // the last attempt to write it back failed: give up on this one
+    if( b->error ) {
+      b->error = false; *r = DISK_FAILURE; return NULL;
+    }
+
+    if( ( t = bcache_bio( q ) ) == NULL ) {
+      *r = BCACHE_AGAIN; return NULL;
+    }
+
+    disk_io_wr( &t->io, b->a, b->data, bcacheLen ); bcache_io( t, b );
+
+    *q = &b->wq; *r = BCACHE_AGAIN; return NULL;
+  }
+
+  bcache_drop( b );
+
+  b->a     = a;
+  b->used  = true;
+  b->valid = false;
+  b->dirty = false;
+  b->fresh = false;
+  b->error = false;
+  b->hash  = *hash_bucket( a ); *hash_bucket( a ) = b;
+
+  lru_remove( b ); lru_push( b ); bcacheUsed++;
+
+  return b;
+}
+
+// a read ahead has finished: fill its buffers from the stage, or, if it
+// failed, forget them (so a read of any of them tries again)
+static void bcache_fetched( disk_io_t* io ) {
+  batch_t* t  = ( batch_t* )( io->arg );
+  bool     ok = ( io->r == io->k );
+
+  for( int i = 0; i < t->n; i++ ) {
+    buf_t* b = t->bufs[ i ];
+
+    b->busy = false;
+
+    if( ok ) {
+      kmem_copy( b->data, t->stage + i * bcacheLen, bcacheLen );
+
+      b->valid = true;
+    }
+    else {
+      bcache_drop( b );
+    }
+
+    wake_all( &b->wq );
+  }
+
+  t->busy = false;
+}
+
+// read ahead of block a, which stream s has just read: top the window up
+// once less than half of it is left, each run of blocks not yet cached
+// going in one request (so long as a batch is free to take it)
+static void bcache_readahead( stream_t* s, uint32_t a ) {
+  uint32_t end = a + 1 + s->win;
+
+  if( end > bcacheNum ) {
+    end = bcacheNum;
+  }
+
+  if( ( int32_t )( s->ra - ( a + 1 ) ) < 0 ) {
+    s->ra = a + 1;
+  }
+
+  if( ( int )( s->ra - ( a + 1 ) ) > ( s->win / 2 ) ) {
+    return;
+  }
+
+  for( int i = 0; i < BCACHE_RA_IOS && s->ra < end; i++ ) {
+    batch_t* t = &bcacheFetch[ i ]; int r; queue_t* q;
+
+    if( t->busy ) {
+      continue;
+    }
+
+    // skip whatever is cached already, then take the run after it
+    while( s->ra < end && bcache_find( s->ra ) != NULL ) {
+      s->ra++;
+    }
+
+    disk_ext_t e = { s->ra, 0 };
+
+    while( s->ra < end && e.n < bcacheBatchMax && bcache_find( s->ra ) == NULL ) {
+      buf_t* b = bcache_claim( s->ra, &r, &q );
+
+      // no buffer to spare, at least not without waiting: leave the rest
+      if( b == NULL ) {
+        end = s->ra; break;
+      }
+
+      b->busy = true; t->bufs[ e.n++ ] = b; s->ra++;
+    }
+
+    if( e.n == 0 ) {
+      continue;
+    }
+
+    t->n    = e.n;
+    t->busy = true;
+
+    batch_io( t, DISK_REQ_RD, &e, 1 );
+
+    t->io.f   = bcache_fetched;
+    t->io.arg = t;
+
+    disk_submit( &t->io );
+
+    bcacheReadaheads += e.n;
+  }
+}
+
+// block a is being read: find the stream it belongs to (if any), adapt the
+// window of that stream, then read ahead
+static void bcache_stream( uint32_t a ) {
+  stream_t* s = NULL;
+
+  for( int i = 0; i < BCACHE_STREAMS && s == NULL; i++ ) {
+    stream_t* t = &bcacheStream[ i ];
+
+    // the same block again (e.g., re-read by another process): no change
+    if( a == t->last ) {
+      s = t;
+    }
+    // the next block: the stream is sequential, so read further ahead
+    else if( a == t->last + 1 ) {
+      s = t; s->last = a;
+
+      s->win = ( s->win == 0 ) ? BCACHE_RA_MIN : ( 2 * s->win );
+
+      if( s->win > BCACHE_RA_MAX ) {
+        s->win = BCACHE_RA_MAX;
+      }
+    }
+  }
+
+  // near, but not next in, a stream: it is less sequential than it looked,
+  // so read less far ahead of it
+  for( int i = 0; i < BCACHE_STREAMS && s == NULL; i++ ) {
+    stream_t* t = &bcacheStream[ i ];
+    int32_t   d = ( int32_t )( a - t->last );
+
+    if( t->win > 0 && d >= -t->win && d <= t->win ) {
+      s = t; s->last = a; s->win /= 2;
+    }
+  }
+
+  // otherwise, a may start a new stream: replace the stalest
+  if( s == NULL ) {
+    s = &bcacheStream[ 0 ];
+
+    for( int i = 1; i < BCACHE_STREAMS; i++ ) {
+      if( ( int32_t )( bcacheStream[ i ].stamp - s->stamp ) < 0 ) {
+        s = &bcacheStream[ i ];
+      }
+    }
+
+    s->last = a;
+    s->ra   = a + 1;
+    s->win  = 0;
+  }
+
+  s->stamp = ++bcacheStreamClock;
+
+  if( s->win > 0 ) {
+    bcache_readahead( s, a );
+  }
+}
+
+// as bcache_read, bar the read ahead
+static int bcache_fill( uint32_t a, uint8_t* x, queue_t** q ) {
+  int r = DISK_FAILURE;
+
+  buf_t* b = bcache_find( a );
+
+  if( b != NULL && b->valid ) {
+    // the first to read a block read in on demand is the one that missed
+    if( !b->fresh ) {
+      bcacheHits++;
+    }
+
+    kmem_copy( x, b->data, bcacheLen );
+
+    b->fresh = false; lru_remove( b ); lru_push( b );
+
+    return DISK_SUCCESS;
+  }
+
+  if( b != NULL && b->busy ) {
+    *q = &b->wq; return BCACHE_AGAIN;
+  }
+
+  // reading it in failed, so forget it: the next read tries again
+  if( b != NULL && b->error ) {
+    bcache_drop( b ); return DISK_FAILURE;
+  }
+
+  // only claim a buffer once there is a request to read it in with
+  bio_t* t = bcache_bio( q );
+
+  if( t == NULL ) {
+    return BCACHE_AGAIN;
+  }
+
+  if( b == NULL && ( b = bcache_claim( a, &r, q ) ) == NULL ) {
+    return r;
+  }
+
+  bcacheMisses++;
+
+  disk_io_rd( &t->io, a, b->data, bcacheLen ); bcache_io( t, b );
+
+  *q = &b->wq; return BCACHE_AGAIN;
+}
+
+int  bcache_read ( uint32_t a,       uint8_t* x, queue_t** q ) {
+  int r = bcache_init( q );
+
+  if( r != DISK_SUCCESS ) {
+    return r;
+  }
+  if( a >= bcacheNum ) {
+    return DISK_FAILURE;
+  }
+
+  r = bcache_fill( a, x, q );
+
+  // only once a has been read (so after its own read, if any, went first),
+  // so that failed reads neither grow the window nor read further ahead of
+  // a disk that fails them
+  if( r == DISK_SUCCESS ) {
+    bcache_stream( a );
+  }
+
+  return r;
+}
+
+int  bcache_write( uint32_t a, const uint8_t* x, queue_t** q ) {
+  int r = bcache_init( q );
+
+  if( r != DISK_SUCCESS ) {
+    return r;
+  }
+  if( a >= bcacheNum ) {
+    return DISK_FAILURE;
+  }
+
+  buf_t* b = bcache_find( a );
+
+  if( b != NULL && b->busy ) {
+    *q = &b->wq; return BCACHE_AGAIN;
+  }
+
+  if( b != NULL ) {
+    bcacheHits++;
+  }
+  else if( ( b = bcache_claim( a, &r, q ) ) != NULL ) {
+    bcacheMisses++;
+  }
+  else {
+    return r;
+  }
+
+  kmem_copy( b->data, x, bcacheLen );
+
+  b->valid = true;
+  b->fresh = false;
+  b->error = false;
+
+  if( !b->dirty ) {
+    b->dirty = true; bcacheDirty++;
+  }
+
+  lru_remove( b ); lru_push( b );
+
+  return DISK_SUCCESS;
+}
+
+// the flush has finished: carry on with the next, if there are more dirty
+// buffers (and this one succeeded)
+static void bcache_flushed( disk_io_t* io ) {
+  bool ok = ( io->r == io->k );
+
+  for( int i = 0; i < bcacheFlush.n; i++ ) {
+    buf_t* b = bcacheFlush.bufs[ i ];
+
+    b->busy = false;
+
+    if( ok ) {
+      b->dirty = false; bcacheDirty--; bcacheWritebacks++;
+    }
+
+    wake_all( &b->wq );
+  }
+
+  bcacheFlush.busy = false;
+
+  if( ok ) {
+    bcache_flush();
+  }
+  else {
+    bcacheFlushFail = true;
+  }
+
+  if( !bcacheFlush.busy ) {
+    wake_all( &bcacheSyncQ );
+  }
+}
+
+void bcache_flush() {
+  batch_t* t = &bcacheFlush; int m = 0, k = 0;
+
+  if( t->busy || bcacheDirty == 0 ) {
+    return;
+  }
+
+  // take dirty buffers that are not already being written back, sorted by
+  // address so that runs of consecutive blocks become one extent
+  for( int i = 0; i < bcacheBufs && m < bcacheBatchMax; i++ ) {
+    buf_t* b = &bcacheTab[ i ];
+
+    if( !b->used || !b->dirty || b->busy ) {
+      continue;
+    }
+
+    int j = m++;
+
+    while( j > 0 && t->bufs[ j - 1 ]->a > b->a ) {
+      t->bufs[ j ] = t->bufs[ j - 1 ]; j--;
+    }
+
+    t->bufs[ j ] = b;
+  }
+
+  if( m == 0 ) {
+    return;
+  }
+
+  disk_ext_t e[ DISK_VEC_MAX ];
+
+  for( int i = 0; i < m; i++ ) {
+    buf_t* b = t->bufs[ i ];
+
+    if( k > 0 && ( e[ k - 1 ].a + e[ k - 1 ].n ) == b->a ) {
+      e[ k - 1 ].n++;
+    }
+    else {
+      e[ k ].a = b->a; e[ k ].n = 1; k++;
+    }
+
+    kmem_copy( t->stage + i * bcacheLen, b->data, bcacheLen );
+
+    b->busy = true;
+  }
+
+  t->n    = m;
+  t->busy = true;
+
+  batch_io( t, DISK_REQ_WR, e, k );
+
+  t->io.f = bcache_flushed;
+
+  disk_submit( &t->io );
+}
+
+int  bcache_sync ( queue_t** q ) {
+  // report a failed flush once, rather than try it again at once
+  if( !bcacheFlush.busy && bcacheFlushFail ) {
+    bcacheFlushFail = false; return DISK_FAILURE;
+  }
+
+  bcache_flush();
+
+  if( bcacheFlush.busy ) {
+    *q = &bcacheSyncQ; return BCACHE_AGAIN;
+  }
+
+  // anything still dirty is being written back on eviction
+  for( int i = 0; i < bcacheBufs; i++ ) {
+    buf_t* b = &bcacheTab[ i ];
+
+    if( b->used && b->dirty && b->busy ) {
+      *q = &b->wq; return BCACHE_AGAIN;
+    }
+  }
+
+  return DISK_SUCCESS;
+}
+
+int  bcache_len  () {
+  return bcacheLen;
+}
+
+bool bcache_dirty() {
+  return bcacheDirty > 0;
+}
+
+void bcache_stat ( bcachestat_t* x ) {
+  x->num        = bcacheNum;
+  x->len        = bcacheLen;
+  x->bufs       = bcacheBufs;
+  x->used       = bcacheUsed;
+  x->dirty      = bcacheDirty;
+  x->hits       = bcacheHits;
+  x->misses     = bcacheMisses;
+  x->writebacks = bcacheWritebacks;
+  x->readaheads = bcacheReadaheads;
+}
@@ -0,0 +1,142 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __BCACHE_H
+#define __BCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include  "disk.h"
+#include  "kmem.h"
+#include "kheap.h"
+#include "queue.h"
+
+/* The block cache sits in front of the disk (see disk.h), so a block read or
+ * written again while it is cached costs a copy rather than a round trip
+ * over UART2.  It holds BCACHE_BUFS blocks, found by address via a hash
+ * table, and when it needs room evicts the least recently used one.
+ *
+ * Writes are write-back: a block is marked dirty, and only goes to the disk
+ * once it is evicted or the cache is synced, at which point every dirty
+ * block goes in as few (vectored) requests as possible.  The kernel syncs
+ * the cache BCACHE_FLUSH_MS after a block first becomes dirty, and whenever
+ * a process asks it to via SYS_SYNC.
+ *
+ * The disk is accessed asynchronously, so nothing here waits for it: where
+ * a block must first be read in, or a buffer written back, the I/O is
+ * submitted and the function returns BCACHE_AGAIN, plus (in q) the queue
+ * to block the executing process on.  It is woken once that I/O finishes,
+ * and should then try again.
+ *
+ * Reads are watched for sequential streams, i.e., runs of consecutive blocks
+ * (several may be interleaved, e.g., read by different processes): once one
+ * is seen, the blocks after it are read ahead, asynchronously and in a few
+ * large requests, so they are cached by the time they are asked for.  The
+ * window, i.e., how far ahead, doubles (up to BCACHE_RA_MAX blocks) with
+ * each further sequential read, and halves whenever a read lands near the
+ * stream but out of sequence.
+ *
+ * The cache is only set up (i.e., asks the disk for its geometry, and takes
+ * memory for its buffers) the first time it is used, so the kernel runs as
+ * before when there is no disk attached.  Asking the disk is no different
+ * from a miss: the caller is blocked until the acknowledgement arrives, so
+ * if it never does, only the caller waits forever.
+ */
+
+#define BCACHE_BUFS     64   // blocks cached
+#define BCACHE_HASH     32   // hash buckets; must be a power of 2
+#define BCACHE_FLUSH_MS 5000 // most time a block stays dirty, unless evicted
+
+#define BCACHE_STREAMS  4    // sequential streams tracked at once
+#define BCACHE_RA_MIN   4    // blocks read ahead once a stream is seen
+#define BCACHE_RA_MAX   16   // most blocks read ahead of any one stream
+#define BCACHE_RA_IOS   2    // read ahead requests in flight at once
+#define BCACHE_IOS      4    // single-block requests in flight at once
+
+#define BCACHE_AGAIN    ( 1 )
+
+typedef struct buf_t {
+  uint32_t      a;     // block address
+  bool          used;  // assigned to block a, so in the hash table
+  bool          valid; // and holds it
+  bool          dirty; // which differs from the disk
+  bool          fresh; // read in on demand, and not yet read by anyone
+  bool          busy;  // I/O is in flight (so wq is waiting for it)
+  bool          error; // the last I/O failed
+  uint8_t*      data;
+
+  queue_t       wq;
+
+  struct buf_t* hash;  // next buffer in the same hash bucket
+  struct buf_t* prev;  // LRU list: the next more  recently used buffer
+  struct buf_t* next;  //           the next less  recently used buffer
+} buf_t;
+
+// a request that moves one buffer alone, i.e., reads it in on demand or
+// writes it back on eviction: there are only BCACHE_IOS of these, rather than
+// one per buffer, since each holds a whole disk_io_t
+typedef struct {
+  disk_io_t     io;
+  buf_t*        buf;
+  bool          busy;  // io is in flight
+} bio_t;
+
+// buffers moved by one (vectored) request, staged back to back in a page
+typedef struct {
+  disk_io_t     io;
+  uint8_t*      stage;
+  buf_t*        bufs[ DISK_VEC_MAX ];
+  int           n;
+  bool          busy;  // io is in flight
+} batch_t;
+
+typedef struct {
+  uint32_t      last;  // block read last
+  uint32_t      ra;    // blocks before this have been read ahead
+  int           win;   // blocks to read ahead of last, or 0 if not sequential
+  uint32_t      stamp; // when last read, so the stalest is reused first
+} stream_t;
+
+// the statistics SYS_BSTAT returns: this must match the bcachestat_t user
+// programs see (in libc.h)
+typedef struct {
+  uint32_t num;        // blocks on the disk
+  uint32_t len;        // bytes per block
+  uint32_t bufs;       // blocks the cache can hold
+  uint32_t used;       // blocks it does hold
+  uint32_t dirty;      // blocks yet to be written back
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t writebacks; // blocks written back (on eviction or sync)
+  uint32_t readaheads; // blocks read ahead
+} bcachestat_t;
+
+// set the cache up, unless it has been; return DISK_SUCCESS, DISK_FAILURE or
+// BCACHE_AGAIN
+extern int  bcache_init ( queue_t** q );
+// read  block a into x, via the cache; return DISK_SUCCESS, DISK_FAILURE or
+// BCACHE_AGAIN
+extern int  bcache_read ( uint32_t a,       uint8_t* x, queue_t** q );
+// write block a from x, via the cache; return DISK_SUCCESS, DISK_FAILURE or
+// BCACHE_AGAIN
+extern int  bcache_write( uint32_t a, const uint8_t* x, queue_t** q );
+// write every dirty block back; return DISK_SUCCESS, DISK_FAILURE (if some
+// write back since the last sync failed) or BCACHE_AGAIN
+extern int  bcache_sync ( queue_t** q );
+// start to write every dirty block back, unless already doing so
+extern void bcache_flush();
+
+// the block length, once bcache_init has succeeded
+extern int  bcache_len  ();
+// true iff. any block is dirty
+extern bool bcache_dirty();
+// copy the statistics of the cache into x
+extern void bcache_stat ( bcachestat_t* x );
+
+#endif
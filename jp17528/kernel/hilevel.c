@@ -9,43 +9,153 @@
 #include "hilevel.h"
 
 extern void     main_console();
-extern uint32_t tos_user;
-
-pcb_t procTab[ MAX_PROCS ]; // MAX_PROCS == 20
+extern uint32_t bos_kheap;
+extern uint32_t tos_kheap;
+
+// PID i always lives in procTab[ i ] (which is NULL iff. PID i is unused), so
+// looking a process up is an index; the unused PIDs are kept in a stack, so
+// allocating one for fork is constant time too, however large MAX_PROCS is.
+// The PCBs themselves come from pcbCache, so only live processes use memory.
+pcb_t*   procTab[ MAX_PROCS ];
+pid_t    pidFree[ MAX_PROCS ];
+int      pidFreeTop = 0;
+kcache_t pcbCache;
+
+// Terminated PCBs, linked via next, whose memory and page tables are yet to
+// be freed: the handler that terminates a process may still use its PCB
+// (e.g., as the executing process), and its first-level table stays in use
+// until another process is dispatched, so they are freed by pcb_alloc.
+pcb_t*   pcbDead = NULL;
 
 pcb_t* executing = NULL;    // None of the procTab[] is executing at the beginning
 pcb_t* get_pcb ( pid_t pid );
-pcb_t* get_child_pcb();
-
-void print_fork_message();
-void print_dispatch_message(uint8_t prev_pid, uint8_t next_pid);
-void print_timer_handling_interrupt();
-void print_yield_message();
-void print_exit_message();
-void print_execute_message();
-void print_kill_message();
-void print_nice_message();
+pcb_t* pcb_alloc( vm_t* x );
+void   pcb_free ( pcb_t* p );
+
+// Ready processes live in one of PRIO_LEVELS FIFO queues, selected by their
+// key modulo PRIO_LEVELS; readyMap has bit i set iff. readyTab[ i ] is not
+// empty.  sched_clock counts scheduling decisions, and the live keys always
+// fall in the window [ sched_clock - ( PRIO_LEVELS - 1 ), sched_clock ], so
+// rotating readyMap to start at the oldest bucket turns "highest priority"
+// into a count-trailing-zeros.
+queue_t  readyTab[ PRIO_LEVELS ];
+uint32_t readyMap    = 0;
+uint32_t sched_clock = 0;
+
+void   queue_push  ( queue_t* q, pcb_t* p );
+void   queue_remove( queue_t* q, pcb_t* p );
+pcb_t* queue_pop   ( queue_t* q );
+void   queue_splice( queue_t* q, queue_t* r );
+
+// timer #2 of TIMER0 free-runs as a clock source; timer #1 raises the next
+// deadline, if any (see timer_reprogram)
+uint32_t quantum_end    = 0;
+bool     timer_armed    = false;
+uint32_t timer_deadline = 0;
+
+uint32_t timer_now();
+void     timer_reprogram();
+
+// the block cache is synced once flush_due passes, iff. flush_armed, i.e.,
+// BCACHE_FLUSH_MS after a block became dirty (see bcache.h)
+bool     flush_armed = false;
+uint32_t flush_due   = 0;
+
+void     flush_arm();
+void     flush_expire();
+
+// sleeping processes, sorted by increasing wake time
+queue_t sleepQueue = { NULL, NULL };
+
+void sleep_insert( pcb_t* p );
+void sleep_expire();
+
+// processes blocked in SYS_FUTEX_WAIT, hashed by the futex waited on, i.e.,
+// its address plus (see futex_match) the address space if that matters
+queue_t futexTab[ FUTEX_BUCKETS ];
+
+queue_t* futex_queue( uint32_t x );
+bool     futex_match( pcb_t* p, uint32_t x );
+
+// file descriptors 0, 1 and 2 (i.e., stdin, stdout and stderr) refer to
+// UART0, whereas 3 refers to UART1 (i.e., the console)
+uart_t  uartTab[ 2 ];
+
+uart_t* fd_uart( int fd );
+
+void wake    ( pcb_t*   p );
+
+void   ready_insert( pcb_t* p );
+void   ready_remove( pcb_t* p );
+pcb_t* ready_pick();
+void   ready_tick();
+
+// The VFP registers hold the state of vfpOwner (if not NULL), and FPEXC.EN is
+// set iff. vfpOwner is executing: any other process traps on its first VFP
+// instruction, and only then is the state of vfpOwner saved and its own
+// loaded (see vfp_claim).  So a process that never uses the VFP never pays
+// for saving or restoring it.
+pcb_t* vfpOwner = NULL;
+
+void vfp_claim( pcb_t* p );
+
+// The idle process is executed iff. nothing else is runnable: it lives outside
+// procTab and is never on a ready queue, and just waits for an interrupt.
+pcb_t    idle;
+uint32_t idle_stack[ 64 ];
+
+void idle_main();
+
+// the pid klog records for p, which may be the idle process or NULL
+static uint16_t klog_pid( pcb_t* p ) {
+  if     ( p == NULL  ) {
+    return KLOG_NONE;
+  }
+  else if( p == &idle ) {
+    return KLOG_IDLE;
+  }
 
-int emptied_pcb_id();
+  return p->pid;
+}
 
 // dispatch function perfoms a context switch
 // dispatch functions properties:
 //  1. suspends execution of the previous process
 //  2. resumes  execution of the next process
-void dispatch( ctx_t* ctx, pcb_t* prev, pcb_t* next ) {
-  char prev_pid = '?', next_pid = '?';
+// The execution context already lives in each PCB (see lolevel.s), so doing
+// so is just a matter of updating executing.
+void dispatch( pcb_t* prev, pcb_t* next ) {
+  if( prev == next ) {
+    return;
+  }
+
+  // an ldrex by P_{prev} must not let a strex by P_{next} succeed
+  asm volatile( "clrex" );
+
+  klog( KLOG_DISPATCH, klog_pid( prev ), klog_pid( next ) );
+
+  uint32_t now = timer_now();
 
   if( NULL != prev ) {
-    memcpy( &prev->ctx, ctx, sizeof( ctx_t ) ); // preserve execution context of P_{prev}
-    prev_pid = '0' + prev->pid;
+    prev->cpu_time += now - prev->since;
+    prev->since     = now;
   }
-
   if( NULL != next ) {
-    memcpy( ctx, &next->ctx, sizeof( ctx_t ) ); // restore  execution context of P_{next}
-    next_pid = '0' + next->pid;
+    next->since     = now;
   }
 
-  print_dispatch_message(prev_pid, next_pid);
+  if( next != NULL && next == vfpOwner ) {
+    vfp_enable();
+  }
+  else {
+    vfp_unable();
+  }
+
+  // the idle process never touches the user window, so leave it as it is
+  if( NULL != next && NULL != next->vm ) {
+    vm_switch( next->vm );
+    mmu_set_tls( next->tls );
+  }
 
   executing = next; // update current so it points at the executing user process
 
@@ -54,128 +164,160 @@ void dispatch( ctx_t* ctx, pcb_t* prev, pcb_t* next ) {
 
 // Decides which process should resume execution
 // Context-swtiches are executed in this function
-void schedule( ctx_t* ctx ) {
+void schedule() {
 
-  pcb_t* next = executing;
-
-  int MAX_priority = 0;
+  /*
+    Every process that is not picked ages by one per scheduling decision, and
+    the picked one has its age reset to 0.  Rather than touch every process to
+    do so, advancing sched_clock ages all of them at once: a process' priority
+    is base_priority + ( sched_clock - stamp ), so the ready process with the
+    smallest key = stamp - base_priority is the one with the highest priority.
+  */
 
-  for (int i = 0; i < MAX_PROCS; i++) {
-    if (procTab[i].status != STATUS_TERMINATED) {
+  pcb_t* prev = executing;
 
-      // procTab[i]'s priority is decided by using initial setted priority value and its age
-      // 'base_priority' and 'age' can be found in hilevel.h. These two properties have been included
-      // because of this scheduling function
-      int priority = procTab[i].base_priority + procTab[i].age;
-      // !!IMPORTANT!! ** variable 'priority' gets higher prority as number grows **
+  ready_tick();
 
-      // 'next process table (procTab)' is decided by priority that defined just above
-      // If the procTab[i] that we are interested has higher priority then MAX_priority, set that procTab[i] for the 'next process table (procTab)'
-      if (MAX_priority <= priority) {
-        MAX_priority = priority;
-        next = &procTab[i];
-      }
-    }
+  // the executing process competes with the ready ones (with its current age)
+  if( prev != NULL && prev != &idle && prev->status == STATUS_EXECUTING ) {
+    prev->status = STATUS_READY;
+    ready_insert( prev );
   }
 
-  // 1. If procTab[i] is     executed, execute 'if statement'   therefore reset  age to 0.
-  // 2. If procTab[i] is not executed, execute 'else statement' therefore adding age to the procTab[i]
-  for (int i = 0; i < MAX_PROCS; i++) {
-    if (procTab[i].status != STATUS_TERMINATED) {
-      if (next->pid == procTab[i].pid) {
-        procTab[i].age = 0;
-      } else {
-        procTab[i].age += 1;
-      }
-    }
+  pcb_t* next = ready_pick();
+
+  // nothing is runnable, e.g., because every process is asleep or blocked
+  if( next == NULL ) {
+    next = &idle;
   }
 
-  // Context switch
-  dispatch(ctx, executing, next);
+  next->stamp = sched_clock; // reset age to 0
 
-  if (executing->status != STATUS_TERMINATED) {
-    executing->status = STATUS_READY;
-  }
+  quantum_end = timer_now() + QUANTUM;
+
+  // Context switch
+  dispatch(prev, next);
 
   next->status = STATUS_EXECUTING;
 
   return;
 }
 
+// schedule, having taken the processor away from the executing process
+void preempt() {
+  pcb_t* prev = executing;
+
+  schedule();
+
+  if( executing != prev ) {
+    prev->nivcsw++;
+  }
+}
+
 // Initialisation of hilevel_handler_rst
-void hilevel_handler_rst( ctx_t* ctx ) {
+void hilevel_handler_rst() {
 
   /*
     <Strategy in 'hilevel_handler_rst'>
 
   *   1. Set up timer
-        1-1. TIMER0 raises a peridoic interrupt for each timer tick
+        1-1. TIMER0 raises an interrupt when the quantum of the executing process expires
+             (periodically for each timer tick, unless TICKLESS)
         1-2. GICC0  handles interrupt. The selected interrupts are forwarded to the processor
              via the IRA interrupt signal
 
-  *   2. Set all of the process table status to STATUS_INVALID therefore not representing an active process
+  *   2. Set up the kernel heap, then mark every PID as unused (i.e., procTab[i] == NULL)
+        and put them in the free PID stack
 
   *   3. Set up 'console'
-        3-1. set procTab[ 0 ].ctx.pc as ( uint32_t )( &main_console )
-        3-2. base_priority and age were already added to each of the procTab property.
-        3-3. Set up following procTab[i] (1 ≤ i < MAX_PROCS)
+        3-1. allocate its PCB (so it takes PID 0) and set procTab[ 0 ]->ctx.pc as ( uint32_t )( &main_console )
+        3-2. base_priority was already added to each of the procTab property (age is derived from stamp).
 
-  *   4. Check priority of the processes and dispatch highest prioritised procTab[i]
+  *   4. Put the console on its ready queue and dispatch highest prioritised procTab[i]
   */
 
-  int counter = 0;
-  int max     = 0;
-
   // 1
-  TIMER0->Timer1Load  = 0x00100000; // select period = 2^20 ticks ~= 1 sec
+  TIMER0->Timer2Load  = 0xFFFFFFFF; // select period = 2^32 ticks (i.e., wrap-around)
+  TIMER0->Timer2Ctrl  = 0x00000002; // select 32-bit   timer
+  TIMER0->Timer2Ctrl |= 0x00000080; // enable          timer (free-running, no interrupt)
+
+#if TICKLESS
+  TIMER0->Timer1Ctrl  = 0x00000002; // select 32-bit   timer
+  TIMER0->Timer1Ctrl |= 0x00000001; // select one-shot timer
+  TIMER0->Timer1Ctrl |= 0x00000020; // enable          timer interrupt (timer enabled per deadline)
+#else
+  TIMER0->Timer1Load  = QUANTUM;    // select period = 2^20 ticks ~= 1 sec
   TIMER0->Timer1Ctrl  = 0x00000002; // select 32-bit   timer
   TIMER0->Timer1Ctrl |= 0x00000040; // select periodic timer
   TIMER0->Timer1Ctrl |= 0x00000020; // enable          timer interrupt
   TIMER0->Timer1Ctrl |= 0x00000080; // enable          timer
+#endif
 
   GICC0->PMR          = 0x000000F0; // unmask all            interrupts
   GICD0->ISENABLER1  |= 0x00000010; // enable timer          interrupt
+  GICD0->ISENABLER1  |= 0x00001000; // enable UART0          interrupt
+  GICD0->ISENABLER1  |= 0x00002000; // enable UART1          interrupt
+  GICD0->ISENABLER1  |= 0x00004000; // enable UART2          interrupt
   GICC0->CTLR         = 0x00000001; // enable GIC interface
   GICD0->CTLR         = 0x00000001; // enable GIC distributor
 
+  kmem_clear( uartTab, sizeof( uartTab ) );
+  PL011_buf_init( &uartTab[ 0 ].buf, UART0 );
+  PL011_buf_init( &uartTab[ 1 ].buf, UART1 );
+
+  klog_init( &uartTab[ 0 ].buf );
+
+  disk_init();
+
+  vfp_init();
+
   // 2
-  for( int i = 0; i < MAX_PROCS; i++ ) {
-    procTab[ i ].status = STATUS_INVALID;
+  kheap_init( &bos_kheap, &tos_kheap );
+  kcache_init( &pcbCache, "pcb", sizeof( pcb_t ) );
+
+  vm_init();
+
+  // pushed in reverse, so that fork hands out the lowest free PID first
+  for( int i = MAX_PROCS - 1; i >= 0; i-- ) {
+    procTab[ i ] = NULL;
+    pidFree[ pidFreeTop++ ] = i;
   }
 
   // 3
-  memset( &procTab[ 0 ], 0, sizeof( pcb_t ) );
-  procTab[ 0 ].pid      = 0;
-  procTab[ 0 ].status   = STATUS_CREATED;
-  procTab[ 0 ].tos      = ( uint32_t )( &tos_user );
-  procTab[ 0 ].ctx.cpsr = 0x50;
-  procTab[ 0 ].ctx.pc   = ( uint32_t )( &main_console );
-  procTab[ 0 ].ctx.sp   = procTab[ 0 ].tos;
-  procTab[ 0 ].base_priority = 1;
-  procTab[ 0 ].age = 0;
-
-
-  for (int i = 1; i < MAX_PROCS; i++) {
-    memset( &procTab[ i ], 0, sizeof( pcb_t ) );
-    procTab[ i ].pid      = i;
-    procTab[ i ].status   = STATUS_TERMINATED;
-    procTab[ i ].tos      = ( uint32_t )( &tos_user ) - (i * 0x00001000);
-    procTab[ i ].ctx.cpsr = 0x50;
-    procTab[ i ].ctx.sp   = procTab[ i ].tos;
-    procTab[ i ].base_priority = 1;
-    procTab[ i ].age = 0;
-  }
+  pcb_t* console = pcb_alloc( NULL );
+
+  console->status   = STATUS_CREATED;
+  console->ctx.cpsr = 0x50;
+  console->ctx.pc   = ( uint32_t )( &main_console );
+  console->ctx.sp   = console->tos;
+  console->base_priority = 1;
+
+  vm_stack( console->vm, PROCESSOR_SIZE );
+
+  kmem_clear( &idle, sizeof( pcb_t ) );
+  idle.pid      = -1;
+  idle.status   = STATUS_CREATED;
+  idle.tos      = ( uint32_t )( &idle_stack[ 64 ] );
+  idle.ctx.cpsr = 0x50;
+  idle.ctx.pc   = ( uint32_t )( &idle_main );
+  idle.ctx.sp   = idle.tos;
 
   // 4
-  for (int i = 0; i < MAX_PROCS; i++) {
-    int priority = procTab[i].base_priority + procTab[i].age;
-    if (max < priority) {
-      counter = i;
-      max = priority;
-    }
+  for( int i = 0; i < PRIO_LEVELS; i++ ) {
+    readyTab[ i ].head = NULL;
+    readyTab[ i ].tail = NULL;
   }
 
-  dispatch( ctx, NULL, &procTab[ counter ] );
+  ready_insert( console );
+
+  pcb_t* next = ready_pick();
+  next->status = STATUS_EXECUTING;
+
+  quantum_end = timer_now() + QUANTUM;
+
+  dispatch( NULL, next );
+
+  timer_reprogram();
 
   int_enable_irq();
 
@@ -191,99 +333,335 @@ void hilevel_handler_irq( ctx_t* ctx ) {
   // handle the interrupt, then clear (or reset) the source.
   if( id == GIC_SOURCE_TIMER0 ) {
 
-    print_timer_handling_interrupt();
-
-    schedule(ctx);
+    klog( KLOG_TIMER, 0, 0 );
 
     TIMER0->Timer1IntClr = 0x01;
+    timer_armed          = false;
+
+    sleep_expire();
+    flush_expire();
+
+    // the one-shot deadline may have been for something other than quantum
+    // expiry, in which case the executing process keeps the processor
+    if( !TICKLESS || ( int32_t )( timer_now() - quantum_end ) >= 0 ) {
+      preempt();
+    }
+  }
+
+  else if( id == GIC_SOURCE_UART0 || id == GIC_SOURCE_UART1 ) {
+    uart_t*  u = &uartTab[ id - GIC_SOURCE_UART0 ];
+    uint32_t x = PL011_buf_irq( &u->buf );
+
+    if( u == &uartTab[ 0 ] ) {
+      klog_drain();
+    }
+
+    // readers re-check whether what they wait for (e.g., a line) has arrived
+    if( x & ( PL011_INT_RX | PL011_INT_RT ) ) {
+      wake_all( &u->rxq );
+    }
+
+    // don't wake writers for every byte: let the ring drain by half first
+    if( PL011_buf_space( &u->buf ) >= ( PL011_RING_SIZE / 2 ) ) {
+      wake_all( &u->txq );
+    }
+  }
+
+  else if( id == GIC_SOURCE_UART2 ) {
+    disk_irq();
+  }
+
+  // whatever the interrupt made ready should not wait for the idle process
+  if( executing == &idle && readyMap != 0 ) {
+    preempt();
   }
 
   // write the interrupt identifier to signal we're done.
   GICC0->EOIR = id;
 
+  timer_reprogram();
+
+  return;
+}
+
+// A data abort taken by the executing process: a first access to a heap page,
+// or a write to a copy-on-write page, is resolved (and the access
+// re-executed), but any other fault terminates the process.
+void hilevel_handler_abt( ctx_t* ctx ) {
+  uint32_t fsr = mmu_get_dfsr();
+  uint32_t far = mmu_get_dfar();
+
+  // FS = 0b00111 is a translation fault on a page, FS = 0b01111 a permission
+  // fault on a page, and WnR marks a write
+  bool demand = ( ( fsr & 0x40F ) == 0x007 );
+  bool cow    = ( ( fsr & 0x40F ) == 0x00F ) && ( fsr & 0x800 );
+  bool ok     = false;
+
+  if( executing->vm != NULL ) {
+    ok = ( demand && vm_demand( executing->vm, far ) ) ||
+         ( cow    && vm_fault ( executing->vm, far ) );
+  }
+
+  if( !ok ) {
+    klog( KLOG_FAULT, 0, 0 );
+
+    pcb_free( executing );
+
+    schedule();
+  }
+
+  timer_reprogram();
+
+  return;
+}
+
+// true iff. x is a VFP or Advanced SIMD instruction (in ARM state), per
+// Sections A7.5, A7.7 and A7.8 of the ARMv7-A ARM: i.e., a coprocessor
+// instruction for coprocessor 10 or 11, or an unconditional Advanced SIMD
+// data processing or element/structure load/store instruction
+static bool vfp_insn( uint32_t x ) {
+  if( ( x & 0xF0000000 ) == 0xF0000000 ) {
+    return ( ( x & 0xFE000000 ) == 0xF2000000 ) ||
+           ( ( x & 0xFF100000 ) == 0xF4000000 );
+  }
+
+  return ( ( x & 0x0E000000 ) == 0x0C000000 || ( x & 0x0F000000 ) == 0x0E000000 ) &&
+         ( ( x & 0x00000E00 ) == 0x00000A00 );
+}
+
+// An undefined instruction taken by the executing process: a VFP instruction
+// trapped because FPEXC.EN is clear is resolved by handing the VFP over (and
+// the instruction re-executed), but anything else terminates the process.
+void hilevel_handler_und( ctx_t* ctx ) {
+  uint32_t x = *( uint32_t* )( ctx->pc );
+
+  if( vfp_insn( x ) && !( vfp_get_fpexc() & FPEXC_EN ) ) {
+    vfp_claim( executing );
+  }
+  else {
+    klog( KLOG_FAULT, 0, 0 );
+
+    pcb_free( executing );
+
+    schedule();
+  }
+
+  timer_reprogram();
+
   return;
 }
 
+// the length of the string at x in the address space of the executing
+// process, or -1 if any of it is not there, or it is longer than n
+static int spawn_strlen( const char* x, int n ) {
+  for( int i = 0; i <= n; i++ ) {
+    uint32_t y = ( uint32_t )( x + i );
+
+    if( ( i == 0 || ( y & ( VM_PAGE_SIZE - 1 ) ) == 0 ) && !vm_touch( executing->vm, y, 1, false ) ) {
+      return -1;
+    }
+    if( x[ i ] == '\x00' ) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+// copy argv (a NULL terminated array of strings in the address space of the
+// executing process, or NULL for none) onto the top of the stack of p, then
+// point its sp, r0 and r1 at the result, i.e., main( argc, argv ) style; the
+// stack is not mapped in, so it is written via the frame it is mapped to
+static bool spawn_args( pcb_t* p, char** argv ) {
+  uint8_t* top  = ( uint8_t* )( vm_frame( p->vm, p->tos - 1 ) ) + 1;
+  uint32_t sp   = p->tos;
+  uint32_t t[ SPAWN_ARGC + 1 ];
+  int      argc = 0;
+
+  while( argv != NULL ) {
+    if( !vm_touch( executing->vm, ( uint32_t )( &argv[ argc ] ), sizeof( char* ), false ) ) {
+      return false;
+    }
+    if( argv[ argc ] == NULL ) {
+      break;
+    }
+
+    int n = spawn_strlen( argv[ argc ], SPAWN_ARGS );
+
+    if( argc == SPAWN_ARGC || n < 0 || ( p->tos - sp ) + n + 1 > SPAWN_ARGS ) {
+      return false;
+    }
+
+    sp -= n + 1;
+    kmem_copy( top - ( p->tos - sp ), argv[ argc ], n + 1 );
+    t[ argc++ ] = sp;
+  }
+
+  t[ argc ] = 0;
+
+  // the array goes below the strings, with sp 8-byte aligned as per the AAPCS
+  sp = ( sp - ( ( argc + 1 ) * sizeof( uint32_t ) ) ) & ~7;
+
+  if( ( p->tos - sp ) > SPAWN_ARGS ) {
+    return false;
+  }
+
+  kmem_copy( top - ( p->tos - sp ), t, ( argc + 1 ) * sizeof( uint32_t ) );
+
+  p->ctx.gpr[ 0 ] = argc;
+  p->ctx.gpr[ 1 ] = sp;
+  p->ctx.sp       = sp;
+
+  return true;
+}
+
 void hilevel_handler_svc( ctx_t* ctx, uint32_t id ) {
+  pcb_t*   caller = executing;
+  uint32_t pc     = ctx->pc;
+  bool     again  = caller->restarted;
+
+  if( id < NSYSCALLS && !again ) {
+    caller->syscalls[ id ]++;
+  }
+
   switch( id ) {
 
     // 0x00 == yield
     case 0x00 : {
-      print_yield_message();
-      schedule( ctx );
+      klog( KLOG_YIELD, 0, 0 );
+      schedule();
       break;
     }
 
     // 0x01 == write
+    // queue as much as fits in the UART transmit ring; if that is not all of
+    // it, block until the ring drains, then re-issue the call for the rest
     case 0x01 : {
       int   fd = ( int   )( ctx->gpr[ 0 ] );
       char*  x = ( char* )( ctx->gpr[ 1 ] );
       int    n = ( int   )( ctx->gpr[ 2 ] );
 
-      for( int i = 0; i < n; i++ ) {
-        PL011_putc( UART0, *x++, true );
+      uart_t* u = fd_uart( fd );
+
+      if( u == NULL || !vm_touch( executing->vm, ( uint32_t )( x ), n, false ) ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      int    r = PL011_buf_write( &u->buf, ( uint8_t* )( x ), n );
+
+      if( r < n ) {
+        executing->io_done += r;
+
+        ctx->gpr[ 1 ] += r;
+        ctx->gpr[ 2 ] -= r;
+        ctx->pc       -= 4;   // i.e., the svc instruction
+
+        block( &u->txq );
+        break;
+      }
+
+      ctx->gpr[ 0 ] = executing->io_done + n;
+      executing->io_done = 0;
+      break;
+    }
+
+    // 0x02 == read
+    // return once a whole line (up to and including '\n'), or n bytes, can be
+    // read; until then, block and re-issue the call each time input arrives
+    case 0x02 : {
+      int   fd = ( int   )( ctx->gpr[ 0 ] );
+      char*  x = ( char* )( ctx->gpr[ 1 ] );
+      int    n = ( int   )( ctx->gpr[ 2 ] );
+
+      uart_t* u = fd_uart( fd );
+
+      if( u == NULL ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      if( !vm_touch( executing->vm, ( uint32_t )( x ), n, true ) ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      int    l = PL011_buf_find ( &u->buf, '\n' );
+      int    m = PL011_buf_count( &u->buf );
+
+      if( l == 0 && m < n && m < PL011_RING_SIZE ) {
+        ctx->pc       -= 4;   // i.e., the svc instruction
+
+        block( &u->rxq );
+        break;
       }
 
-      ctx->gpr[ 0 ] = n;
+      ctx->gpr[ 0 ] = PL011_buf_read( &u->buf, ( uint8_t* )( x ), ( l != 0 && l < n ) ? l : n );
       break;
     }
 
     // 0x03 == fork
     case 0x03 : {
-      print_fork_message();
+      klog( KLOG_FORK, 0, 0 );
 
       /*
         <Strategy in fork>
 
-       * 1. Find unusing process control block(pcb) by using emptied_pcb_id() and designate child pcb.
+       * 1. pcb_alloc: take a free PID plus a PCB from the PCB cache, which pcb_alloc zeroes, with an
+            empty address space of its own, and designate it the child.
+            If there is none (or no memory), fork fails and returns -1 to the parent.
 
-       * 2. memset: clean up its content like 'section 3' in 'hilevel_handler_rst'.
+       * 2. kmem_copy_ctx: copy context from parent to child.
 
-       * 3. memcpy: copy context from parent to child.
+       * 3. vm_share: share the parent's stack with the child copy-on-write, rather than copy it.
+            The child sees it at the same virtual addresses, so its sp is the parent's as is.
 
-       * 4. memcpy: copy attributes from parent to child.
+       * 4. Set attributes for the child.
 
-       * 5. Calculate offset for the stack pointer(sp) of child process table.
-            This offset is used for the following process table setting for child.
-
-       * 6. Set return
+       * 5. Set return
 
        */
 
-      int id = emptied_pcb_id();
-      pcb_t* child = get_child_pcb();
+      pcb_t* child = pcb_alloc( NULL );
+
+      if( child == NULL ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      kmem_copy_ctx( &child->ctx, ctx );
+
+      // the parent's VFP state is live in the registers iff. it is vfpOwner
+      if( executing == vfpOwner ) {
+        vfp_save( &child->vfp );
+      }
+      else {
+        kmem_copy( &child->vfp, &executing->vfp, sizeof( vfp_t ) );
+      }
 
-      memset( child, 0, sizeof( pcb_t ) );
-      memcpy( &child->ctx, ctx, sizeof( ctx_t ) );
+      vm_share( child->vm, executing->vm );
 
-      uint32_t PARENT = executing->tos - PROCESSOR_SIZE;
-      uint32_t CHILD  = child->tos     - PROCESSOR_SIZE;
-      memcpy( ( void* ) CHILD, ( void* ) PARENT, PROCESSOR_SIZE );
+      child->status           = STATUS_CREATED;
+      child->tls              = executing->tls;
+      child->ctx.cpsr         = 0x50;
+      child->base_priority    = 1;
+      child->stamp            = sched_clock;
 
-      uint32_t offset = (uint32_t)( executing->tos - ctx->sp );
-      procTab[ id ].pid              = id;
-      procTab[ id ].status           = STATUS_CREATED;
-      procTab[ id ].tos              = ( uint32_t )( &tos_user ) - (id * PROCESSOR_SIZE);
-      procTab[ id ].ctx.cpsr         = 0x50;
-      procTab[ id ].ctx.sp           = procTab[ id ].tos - offset;
-      procTab[ id ].base_priority    = 1;
-      procTab[ id ].age              = 0;
+      ctx->gpr[ 0 ] = child->pid;
+      child->ctx.gpr[ 0 ] = 0;
 
-      ctx->gpr[ 0 ] = procTab[ id ].pid;
-      procTab[ id ].ctx.gpr[ 0 ] = 0;
+      ready_insert( child );
 
       break;
     }
 
     // 0x04 == exit
     case 0x04 : {
-      print_exit_message();
+      klog( KLOG_EXIT, 0, 0 );
 
-      memset(executing, 0, sizeof( pcb_t ));
+      pcb_free( executing );
 
-      executing->status = STATUS_TERMINATED;
-
-      schedule(ctx);
+      schedule();
 
       break;
     }
@@ -292,7 +670,52 @@ void hilevel_handler_svc( ctx_t* ctx, uint32_t id ) {
     // execute processes
     // ex) execute P3, execute P4, execute P5, and execute DP
     case 0x05 : {
-      print_execute_message();
+      klog( KLOG_EXEC, 0, 0 );
+
+      // the new image starts on a fresh stack, so any frame still shared
+      // with the parent is dropped rather than copied; a thread leaves its
+      // group for an address space of its own, rather than pull the others'
+      // out from under them
+      if( executing->vm->users > 1 ) {
+        vm_t* x = vm_create( executing->pid );
+
+        if( x == NULL ) {
+          pcb_free( executing );
+          schedule();
+          break;
+        }
+
+        vm_detach ( executing->vm );
+        vm_destroy( executing->vm );
+
+        executing->vm   = x;
+        executing->tgid = executing->pid;
+
+        vm_switch( x );
+      }
+      else {
+        vm_free( executing->vm );
+      }
+
+      executing->tls = 0; mmu_set_tls( 0 );
+
+      // nor does it inherit any VFP state
+      if( executing == vfpOwner ) {
+        vfpOwner = NULL;
+        vfp_unable();
+      }
+
+      kmem_clear( &executing->vfp, sizeof( vfp_t ) );
+
+      // a thread's tos is its own stack (e.g., in the heap), which the new
+      // image does not have
+      executing->tos = VM_USER_TOP;
+
+      if( !vm_stack( executing->vm, PROCESSOR_SIZE ) ) {
+        pcb_free( executing );
+        schedule();
+        break;
+      }
 
       // set return
       ctx->pc = ctx->gpr[0];
@@ -303,12 +726,22 @@ void hilevel_handler_svc( ctx_t* ctx, uint32_t id ) {
 
     // 0x06 == kill
     case 0x06 : {
-      print_kill_message();
+      klog( KLOG_KILL, 0, 0 );
 
       pcb_t* flag = get_pcb( ( pid_t )ctx->gpr[0] );
       if (flag != NULL) {
-        memset( flag, 0, sizeof( pcb_t ));
-        flag->status = STATUS_TERMINATED;
+        if( flag->status == STATUS_CREATED || flag->status == STATUS_READY ) {
+          ready_remove( flag );
+        }
+        else if( flag->status == STATUS_WAITING ) {
+          queue_remove( flag->wq, flag );
+        }
+
+        pcb_free( flag );
+
+        if( flag == executing ) {
+          schedule();
+        }
       }
 
       break;
@@ -316,22 +749,405 @@ void hilevel_handler_svc( ctx_t* ctx, uint32_t id ) {
 
     // 0x07 == nice
     case 0x07 :{
-      print_nice_message();
+      klog( KLOG_NICE, 0, 0 );
 
       int pid = ( pid_t )ctx->gpr[0];
       int base_priority = ctx->gpr[1];
-      if(pid >= 0 && pid < MAX_PROCS && base_priority >= 0 && base_priority <= MAX_PROCS){
-         procTab[pid].base_priority = base_priority;
-         schedule(ctx);
+      pcb_t* p = get_pcb( pid );
+      if(p != NULL && base_priority >= 0 && base_priority < PRIO_LEVELS){
+
+         // the key depends on base_priority, so a queued process is re-queued
+         if( p->status == STATUS_CREATED || p->status == STATUS_READY ) {
+           ready_remove( p );
+           p->base_priority = base_priority;
+           ready_insert( p );
+         }
+         else {
+           p->base_priority = base_priority;
+         }
+
+         schedule();
        }
       break;
     }
 
+    // 0x08 == sleep
+    // block the process until (at least) ms milliseconds have elapsed, bar
+    // that ms is capped at INT32_MAX / TICKS_PER_MS (i.e., about 35 minutes)
+    case 0x08 : {
+      uint32_t ms = ( uint32_t )( ctx->gpr[ 0 ] );
+
+      // wake is compared with the time via a signed difference, so must be
+      // less than 2^31 ticks away
+      if( ms > ( INT32_MAX / TICKS_PER_MS ) ) {
+        ms = INT32_MAX / TICKS_PER_MS;
+      }
+
+      executing->wake   = timer_now() + ( ms * TICKS_PER_MS );
+      executing->status = STATUS_WAITING;
+      sleep_insert( executing );
+
+      schedule();
+
+      break;
+    }
+
+    // 0x09 == futex wait
+    // block iff. the int at address x still holds v; once woken, return the
+    // number of processes still waiting on x (or -1 if *x != v already)
+    case 0x09 : {
+      uint32_t x = ( uint32_t )( ctx->gpr[ 0 ] );
+      int      v = ( int      )( ctx->gpr[ 1 ] );
+
+      if( !vm_touch( executing->vm, x, sizeof( int ), false ) || *( volatile int* )( x ) != v ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      executing->futex  = x;
+      block( futex_queue( x ) );
+
+      break;
+    }
+
+    // 0x0A == futex wake
+    // wake up to n processes waiting on address x, return the number woken
+    case 0x0A : {
+      uint32_t x = ( uint32_t )( ctx->gpr[ 0 ] );
+      int      n = ( int      )( ctx->gpr[ 1 ] );
+
+      queue_t* q = futex_queue( x );
+      int      m = 0, r = 0;
+
+      for( pcb_t* p = q->head; p != NULL; p = p->next ) {
+        if( futex_match( p, x ) ) {
+          m++;
+        }
+      }
+
+      // wake in FIFO order; each process woken learns how many are left
+      for( pcb_t* p = q->head; p != NULL && r < n; ) {
+        pcb_t* t = p->next;
+
+        if( futex_match( p, x ) ) {
+          queue_remove( q, p );
+
+          p->ctx.gpr[ 0 ] = m - ( ( n < m ) ? n : m );
+          wake( p );
+
+          r++;
+        }
+
+        p = t;
+      }
+
+      ctx->gpr[ 0 ] = r;
+
+      break;
+    }
+
+    // 0x0B == ps
+    // snapshot the first process in procTab[ i ] onward, or the idle process
+    // for i == MAX_PROCS, into x; return the i to ask for next, or -1 if none
+    case 0x0B : {
+      int         i = ( int         )( ctx->gpr[ 0 ] );
+      procstat_t* x = ( procstat_t* )( ctx->gpr[ 1 ] );
+
+      while( i >= 0 && i < MAX_PROCS && procTab[ i ] == NULL ) {
+        i++;
+      }
+
+      if( i < 0 || i > MAX_PROCS || !vm_touch( executing->vm, ( uint32_t )( x ), sizeof( procstat_t ), true ) ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      pcb_t*   p   = ( i == MAX_PROCS ) ? &idle : procTab[ i ];
+      uint64_t cpu = p->cpu_time;
+
+      // the caller is executing, so its current stint has not been counted yet
+      if( p == executing ) {
+        cpu += timer_now() - p->since;
+      }
+
+      x->pid           = p->pid;
+      x->tgid          = p->tgid;
+      x->status        = p->status;
+      x->base_priority = p->base_priority;
+      x->cpu_time      = ( uint32_t )( cpu          / TICKS_PER_MS );
+      x->wait_time     = ( uint32_t )( p->wait_time / TICKS_PER_MS );
+      x->nvcsw         = p->nvcsw;
+      x->nivcsw        = p->nivcsw;
+
+      kmem_copy( x->syscalls, p->syscalls, sizeof( x->syscalls ) );
+
+      ctx->gpr[ 0 ] = i + 1;
+      break;
+    }
+
+    // 0x0C == slab
+    // snapshot the statistics of the i-th kernel heap cache (or, for i = 0,
+    // of the page allocator) into x; return the i to ask for next, or -1
+    case 0x0C : {
+      int         i = ( int         )( ctx->gpr[ 0 ] );
+      slabstat_t* x = ( slabstat_t* )( ctx->gpr[ 1 ] );
+      slabstat_t  t;
+
+      if( i < 0 || !kheap_stat( i, &t ) || !vm_touch( executing->vm, ( uint32_t )( x ), sizeof( slabstat_t ), true ) ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      kmem_copy( x, &t, sizeof( slabstat_t ) );
+
+      ctx->gpr[ 0 ] = i + 1;
+      break;
+    }
+
+    // 0x0D == brk
+    // move the end of the heap to x, unless x is 0; return where it ends, or
+    // -1 if it cannot be moved there
+    case 0x0D : {
+      uint32_t x = ( uint32_t )( ctx->gpr[ 0 ] );
+
+      if( x != 0 && !vm_brk( executing->vm, x ) ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      ctx->gpr[ 0 ] = executing->vm->brk;
+      break;
+    }
+
+    // 0x0E == spawn
+    // create a process that starts executing entry, at base priority
+    // priority, on a fresh stack holding a copy of argv; return its PID, or
+    // -1 if it cannot be created.  Unlike fork then exec, nothing of the
+    // caller is shared with the new process (and so nothing need be made
+    // copy-on-write, then dropped again)
+    case 0x0E : {
+      klog( KLOG_SPAWN, 0, 0 );
+
+      uint32_t entry    = ( uint32_t )( ctx->gpr[ 0 ] );
+      int      priority = ( int      )( ctx->gpr[ 1 ] );
+      char**   argv     = ( char**   )( ctx->gpr[ 2 ] );
+
+      pcb_t* child = pcb_alloc( NULL );
+
+      if( child == NULL ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      if( !vm_stack( child->vm, PROCESSOR_SIZE ) || !spawn_args( child, argv ) ) {
+        pcb_free( child );
+
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      child->status           = STATUS_CREATED;
+      child->ctx.cpsr         = 0x50;
+      child->ctx.pc           = entry;
+      child->base_priority    = ( priority >= 0 && priority < PRIO_LEVELS ) ? priority : 1;
+      child->stamp            = sched_clock;
+
+      ready_insert( child );
+
+      ctx->gpr[ 0 ] = child->pid;
+      break;
+    }
+
+    // 0x0F == thread_create
+    // create a thread, i.e., a process in the thread group (and so address
+    // space) of the caller, that starts executing entry( arg ) with its sp
+    // and TPIDRURO set to stack (so the C library can keep what it needs per
+    // thread just above the stack); entry must not return.  Return its PID,
+    // or -1 if it cannot be created
+    case 0x0F : {
+      klog( KLOG_THREAD, 0, 0 );
+
+      uint32_t entry = ( uint32_t )( ctx->gpr[ 0 ] );
+      uint32_t arg   = ( uint32_t )( ctx->gpr[ 1 ] );
+      uint32_t stack = ( uint32_t )( ctx->gpr[ 2 ] );
+
+      pcb_t* child = pcb_alloc( executing->vm );
+
+      if( child == NULL ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      child->tgid             = executing->tgid;
+      child->tls              = stack;
+      child->tos              = stack & ~7;
+
+      child->status           = STATUS_CREATED;
+      child->ctx.cpsr         = 0x50;
+      child->ctx.pc           = entry;
+      child->ctx.sp           = child->tos;
+      child->ctx.gpr[ 0 ]     = arg;
+      child->base_priority    = executing->base_priority;
+      child->stamp            = sched_clock;
+
+      ready_insert( child );
+
+      ctx->gpr[ 0 ] = child->pid;
+      break;
+    }
+
+    // 0x10 == thread_join
+    // block until process pid, a thread in the caller's group, has
+    // terminated; return 0 once it has (or at once, if it already has), or -1
+    // if pid is the caller or a process outside its group
+    case 0x10 : {
+      pcb_t* p = get_pcb( ( pid_t )( ctx->gpr[ 0 ] ) );
+
+      if( p == executing || ( p != NULL && p->vm != executing->vm ) ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      ctx->gpr[ 0 ] = 0;
+
+      if( p != NULL ) {
+        block( &p->joinq );
+      }
+
+      break;
+    }
+
+    // 0x11 == sync
+    // write every dirty block in the cache back to the disk, blocking (and
+    // re-issuing the call each time it is woken) until done; return 0, or -1
+    // on failure
+    case 0x11 : {
+      queue_t* q;
+      int      r = bcache_sync( &q );
+
+      if( r == BCACHE_AGAIN ) {
+        ctx->pc       -= 4;   // i.e., the svc instruction
+
+        block( q );
+        break;
+      }
+
+      flush_armed = false;
+
+      ctx->gpr[ 0 ] = r;
+
+      flush_arm();
+      break;
+    }
+
+    // 0x12 == bread
+    // read block a of the disk into x, via the cache; x must have room for a
+    // block (as per bstat).  While the block is read in, block, then re-issue
+    // the call once woken; return 0, or -1 on failure
+    case 0x12 : {
+      uint32_t a = ( uint32_t )( ctx->gpr[ 0 ] );
+      uint8_t* x = ( uint8_t* )( ctx->gpr[ 1 ] );
+      queue_t* q;
+      int      r = bcache_init( &q );
+
+      if( r == BCACHE_AGAIN ) {
+        ctx->pc       -= 4;   // i.e., the svc instruction
+
+        block( q );
+        break;
+      }
+
+      if( r != DISK_SUCCESS || !vm_touch( executing->vm, ( uint32_t )( x ), bcache_len(), true ) ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      r = bcache_read( a, x, &q );
+
+      if( r == BCACHE_AGAIN ) {
+        ctx->pc       -= 4;   // i.e., the svc instruction
+
+        block( q );
+        break;
+      }
+
+      ctx->gpr[ 0 ] = r;
+      break;
+    }
+
+    // 0x13 == bwrite
+    // write block a of the disk from x, via the cache, i.e., it reaches the
+    // disk once evicted or synced.  Should a buffer for it first have to be
+    // written back, block, then re-issue the call; return 0, or -1 on failure
+    case 0x13 : {
+      uint32_t a = ( uint32_t )( ctx->gpr[ 0 ] );
+      uint8_t* x = ( uint8_t* )( ctx->gpr[ 1 ] );
+      queue_t* q;
+      int      r = bcache_init( &q );
+
+      if( r == BCACHE_AGAIN ) {
+        ctx->pc       -= 4;   // i.e., the svc instruction
+
+        block( q );
+        break;
+      }
+
+      if( r != DISK_SUCCESS || !vm_touch( executing->vm, ( uint32_t )( x ), bcache_len(), false ) ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      r = bcache_write( a, x, &q );
+
+      if( r == BCACHE_AGAIN ) {
+        ctx->pc       -= 4;   // i.e., the svc instruction
+
+        block( q );
+        break;
+      }
+
+      ctx->gpr[ 0 ] = r;
+
+      flush_arm();
+      break;
+    }
+
+    // 0x14 == bstat
+    // snapshot the statistics of the block cache into x; return 0, or -1 on
+    // failure
+    case 0x14 : {
+      bcachestat_t* x = ( bcachestat_t* )( ctx->gpr[ 0 ] );
+      bcachestat_t  t;
+
+      if( !vm_touch( executing->vm, ( uint32_t )( x ), sizeof( bcachestat_t ), true ) ) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      bcache_stat( &t );
+
+      kmem_copy( x, &t, sizeof( bcachestat_t ) );
+
+      ctx->gpr[ 0 ] = 0;
+      break;
+    }
+
     default : { // Unknown input occurred
       break;
     }
   }
 
+  // the call blocked, to be re-issued once woken (i.e., the pc was wound back
+  // to the svc instruction)
+  caller->restarted = ( ctx->pc == ( pc - 4 ) );
+
+  // the caller gave up the processor (e.g., it yielded, blocked or exited),
+  // bar if it already did so earlier in the same call
+  if( executing != caller && !again ) {
+    caller->nvcsw++;
+  }
+
+  timer_reprogram();
 
   return;
 }
@@ -339,110 +1155,411 @@ void hilevel_handler_svc( ctx_t* ctx, uint32_t id ) {
 /******************************************************************************/
 
 pcb_t* get_pcb ( pid_t pid ) {
+  if( pid < 0 || pid >= MAX_PROCS ) {
+    return NULL;
+  }
+  return procTab[ pid ];
+}
 
-  for (int i = 0; i < MAX_PROCS; i++) {
-    if (procTab[ i ].pid == pid) {
-      return &procTab[ i ];
-    }
+// take an unused PID plus a zeroed PCB for it, or return NULL if there is none
+// (or not enough memory): the PCB shares address space x (i.e., it is a
+// thread) unless x is NULL, in which case it gets an empty one of its own
+pcb_t* pcb_alloc( vm_t* x ) {
+  while( pcbDead != NULL ) {
+    pcb_t* p = pcbDead; pcbDead = p->next;
+
+    vm_destroy( p->vm );
+    kcache_free( &pcbCache, p );
+  }
+
+  if( pidFreeTop == 0 ) {
+    return NULL;
+  }
+
+  pcb_t* p = kcache_alloc( &pcbCache );
+
+  if( p == NULL ) {
+    return NULL;
+  }
+
+  kmem_clear( p, sizeof( pcb_t ) );
+
+  p->pid  = pidFree[ pidFreeTop - 1 ];
+  p->tgid = p->pid;
+  p->tos  = VM_USER_TOP;
+
+  if( x != NULL ) {
+    vm_attach( x );
   }
-  return NULL;
+  else if( ( x = vm_create( p->pid ) ) == NULL ) {
+    kcache_free( &pcbCache, p ); return NULL;
+  }
+
+  p->vm = x;
+
+  pidFreeTop--;
+  procTab[ p->pid ] = p;
+
+  return p;
+}
+
+// terminate p: release its stack and PID at once, but leave the rest to be
+// freed once nothing uses it (see pcbDead)
+void pcb_free( pcb_t* p ) {
+  vm_detach( p->vm );
+
+  // the VFP registers hold nothing worth saving any more
+  if( p == vfpOwner ) {
+    vfpOwner = NULL;
+  }
+
+  procTab[ p->pid ] = NULL;
+  pidFree[ pidFreeTop++ ] = p->pid;
+
+  // any thread joining p can go on (having been told 0 when it blocked)
+  wake_all( &p->joinq );
+
+  p->status = STATUS_TERMINATED;
+
+  p->next   = pcbDead;
+  pcbDead   = p;
+}
+
+// timer #2 counts down from 2^32 - 1, so its complement counts up in us
+uint32_t timer_now() {
+  return ~TIMER0->Timer2Value;
 }
 
-pcb_t* get_child_pcb() {
-  for (int i = 0; i < MAX_PROCS; i++) {
-    if (procTab[ i ].status == STATUS_TERMINATED) {
-      return &procTab[ i ];
+// Program timer #1 for the next event the kernel cares about, or leave it
+// disabled if there is none: while nothing else is ready, the executing
+// process keeps the processor without any further interrupts.
+void timer_reprogram() {
+#if TICKLESS
+  bool     armed    = false;
+  uint32_t deadline = 0;
+
+  if( readyMap != 0 ) {
+    armed    = true;
+    deadline = quantum_end;
+  }
+
+  if( sleepQueue.head != NULL ) {
+    uint32_t wake = sleepQueue.head->wake;
+
+    if( !armed || ( int32_t )( wake - deadline ) < 0 ) {
+      armed    = true;
+      deadline = wake;
     }
   }
-  return NULL;
+
+  if( flush_armed ) {
+    if( !armed || ( int32_t )( flush_due - deadline ) < 0 ) {
+      armed    = true;
+      deadline = flush_due;
+    }
+  }
+
+  if( armed == timer_armed && deadline == timer_deadline ) {
+    return;
+  }
+
+  TIMER0->Timer1Ctrl  &= ~0x00000080; // disable timer
+  TIMER0->Timer1IntClr =  0x01;
+
+  if( armed ) {
+    int32_t delta = ( int32_t )( deadline - timer_now() );
+
+    TIMER0->Timer1Load  = ( delta > 0 ) ? delta : 1;
+    TIMER0->Timer1Ctrl |= 0x00000080; // enable  timer
+  }
+
+  timer_armed    = armed;
+  timer_deadline = deadline;
+#endif
+}
+
+void flush_arm() {
+  if( !flush_armed && bcache_dirty() ) {
+    flush_armed = true;
+    flush_due   = timer_now() + ( BCACHE_FLUSH_MS * TICKS_PER_MS );
+  }
 }
 
-int emptied_pcb_id() {
-  for( int i = 0; i < MAX_PROCS; i++ ) {
-    if( procTab[ i ].status == STATUS_TERMINATED ) {
-      return i;
+// start to flush the block cache if it is due; whatever is still dirty
+// after that (i.e., is being written back, or failed to be) is due again
+// BCACHE_FLUSH_MS later
+void flush_expire() {
+  if( flush_armed && ( int32_t )( timer_now() - flush_due ) >= 0 ) {
+    flush_armed = false;
+
+    bcache_flush(); flush_arm();
+  }
+}
+
+// true iff. x is a private address, i.e., within the user window, where the
+// same address means something else in each address space (bar those of
+// threads, which share one); anywhere else it is shared by every process
+static bool futex_private( uint32_t x ) {
+  return x >= VM_USER_BASE && x < VM_USER_TOP;
+}
+
+// the queue of the futex the executing process knows as x, so unrelated
+// processes waiting at the same private address tend not to share one
+queue_t* futex_queue( uint32_t x ) {
+  uint32_t k = x >> 2;
+
+  if( futex_private( x ) ) {
+    k ^= ( uint32_t )( executing->vm ) >> 4;
+  }
+
+  return &futexTab[ k % FUTEX_BUCKETS ];
+}
+
+// true iff. p waits on the futex the executing process knows as x
+bool futex_match( pcb_t* p, uint32_t x ) {
+  if( p->futex != x ) {
+    return false;
+  }
+
+  return !futex_private( x ) || p->vm == executing->vm;
+}
+
+// wfi suspends the processor until an interrupt, which then either makes
+// some process ready (and so preempts the idle process) or not
+void idle_main() {
+  while( 1 ) {
+    asm volatile( "wfi" );
+  }
+}
+
+// give p the VFP: save the state of the previous owner, if any, then load
+// that of p (unless it is still in the registers), and enable it
+void vfp_claim( pcb_t* p ) {
+  vfp_enable();
+
+  if( vfpOwner != p ) {
+    if( vfpOwner != NULL ) {
+      vfp_save( &vfpOwner->vfp );
     }
+
+    vfp_load( &p->vfp );
+
+    vfpOwner = p;
+  }
+}
+
+uart_t* fd_uart( int fd ) {
+  switch( fd ) {
+    case 0  :
+    case 1  :
+    case 2  : return &uartTab[ 0 ];
+    case 3  : return &uartTab[ 1 ];
+    default : return NULL;
+  }
+}
+
+// block the executing process on wait queue q, then pick another to execute
+void block( queue_t* q ) {
+  executing->status = STATUS_WAITING;
+  executing->wq     = q;
+  queue_push( q, executing );
+
+  schedule();
+}
+
+// make p, which has already been removed from its wait queue, ready again
+void wake( pcb_t* p ) {
+  p->wait_time += timer_now() - p->since;
+
+  p->wq     = NULL;
+  p->status = STATUS_READY;
+  ready_insert( p );
+}
+
+// make every process blocked on wait queue q ready again
+void wake_all( queue_t* q ) {
+  pcb_t* p;
+
+  while( ( p = queue_pop( q ) ) != NULL ) {
+    wake( p );
+  }
+}
+
+// insert p into sleepQueue, after any process due to wake no later than it
+void sleep_insert( pcb_t* p ) {
+  pcb_t* q = sleepQueue.tail;
+
+  while( q != NULL && ( int32_t )( q->wake - p->wake ) > 0 ) {
+    q = q->prev;
+  }
+
+  p->wq   = &sleepQueue;
+  p->prev = q;
+
+  if( q != NULL ) {
+    p->next = q->next;
+    q->next = p;
+  }
+  else {
+    p->next = sleepQueue.head;
+    sleepQueue.head = p;
+  }
+
+  if( p->next != NULL ) {
+    p->next->prev   = p;
+  }
+  else {
+    sleepQueue.tail = p;
   }
-  return -1;
 }
 
-void print_fork_message(){
-  PL011_putc( UART0, '[', true);
-  PL011_putc( UART0, 'F', true);
-  PL011_putc( UART0, 'O', true);
-  PL011_putc( UART0, 'R', true);
-  PL011_putc( UART0, 'K', true);
-  PL011_putc( UART0, ']', true);
-  PL011_putc( UART0, '\n',     true );
-}
-
-void print_dispatch_message(uint8_t prev_pid, uint8_t next_pid){
-  PL011_putc( UART0, '[',      true );
-  PL011_putc( UART0, prev_pid, true );
-  PL011_putc( UART0, '-',      true );
-  PL011_putc( UART0, '>',      true );
-  PL011_putc( UART0, next_pid, true );
-  PL011_putc( UART0, ']',      true );
-  PL011_putc( UART0, '\n',     true );
-}
-
-void print_timer_handling_interrupt(){
-  PL011_putc( UART0, '[', true );
-  PL011_putc( UART0, 'T', true );
-  PL011_putc( UART0, 'I', true );
-  PL011_putc( UART0, 'M', true );
-  PL011_putc( UART0, 'E', true );
-  PL011_putc( UART0, 'R', true );
-  PL011_putc( UART0, ']', true );
-  PL011_putc( UART0, '\n', true );
-}
-
-void print_yield_message(){
-  PL011_putc( UART0, '[', true);
-  PL011_putc( UART0, 'Y', true);
-  PL011_putc( UART0, 'I', true);
-  PL011_putc( UART0, 'E', true);
-  PL011_putc( UART0, 'L', true);
-  PL011_putc( UART0, 'D', true);
-  PL011_putc( UART0, ']', true);
-}
-
-void print_exit_message(){
-  PL011_putc( UART0, '[', true);
-  PL011_putc( UART0, 'E', true);
-  PL011_putc( UART0, 'X', true);
-  PL011_putc( UART0, 'I', true);
-  PL011_putc( UART0, 'T', true);
-  PL011_putc( UART0, ']', true);
-}
-
-void print_execute_message(){
-  PL011_putc( UART0, '[', true);
-  PL011_putc( UART0, 'E', true);
-  PL011_putc( UART0, 'X', true);
-  PL011_putc( UART0, 'E', true);
-  PL011_putc( UART0, 'C', true);
-  PL011_putc( UART0, 'U', true);
-  PL011_putc( UART0, 'T', true);
-  PL011_putc( UART0, 'E', true);
-  PL011_putc( UART0, ']', true);
-}
-
-void print_kill_message(){
-  PL011_putc( UART0, '[', true);
-  PL011_putc( UART0, 'K', true);
-  PL011_putc( UART0, 'I', true);
-  PL011_putc( UART0, 'L', true);
-  PL011_putc( UART0, 'L', true);
-  PL011_putc( UART0, ']', true);
-}
-
-void print_nice_message(){
-  PL011_putc( UART0, '[', true );
-  PL011_putc( UART0, 'N', true );
-  PL011_putc( UART0, 'I', true );
-  PL011_putc( UART0, 'C', true );
-  PL011_putc( UART0, 'E', true );
-  PL011_putc( UART0, ']', true );
+// make every process whose wake time has passed ready again; they keep the
+// age accumulated while asleep
+void sleep_expire() {
+  uint32_t now = timer_now();
+
+  while( sleepQueue.head != NULL && ( int32_t )( now - sleepQueue.head->wake ) >= 0 ) {
+    wake( queue_pop( &sleepQueue ) );
+  }
 }
+
+// append p to the tail of q
+void queue_push( queue_t* q, pcb_t* p ) {
+  p->next = NULL;
+  p->prev = q->tail;
+
+  if( q->tail != NULL ) {
+    q->tail->next = p;
+  }
+  else {
+    q->head       = p;
+  }
+
+  q->tail = p;
+}
+
+// unlink p, which must be in q, from q
+void queue_remove( queue_t* q, pcb_t* p ) {
+  if( p->prev != NULL ) {
+    p->prev->next = p->next;
+  }
+  else {
+    q->head       = p->next;
+  }
+
+  if( p->next != NULL ) {
+    p->next->prev = p->prev;
+  }
+  else {
+    q->tail       = p->prev;
+  }
+
+  p->next = NULL;
+  p->prev = NULL;
+}
+
+// remove and return the head of q, or NULL if q is empty
+pcb_t* queue_pop( queue_t* q ) {
+  pcb_t* p = q->head;
+
+  if( p != NULL ) {
+    queue_remove( q, p );
+  }
+
+  return p;
+}
+
+// move every process in r, in order, onto the front of q
+void queue_splice( queue_t* q, queue_t* r ) {
+  if( r->head == NULL ) {
+    return;
+  }
+
+  if( q->head != NULL ) {
+    r->tail->next = q->head;
+    q->head->prev = r->tail;
+  }
+  else {
+    q->tail       = r->tail;
+  }
+
+  q->head = r->head;
+
+  r->head = NULL;
+  r->tail = NULL;
+}
+
+// the oldest key still inside the window; anything older has saturated
+static uint32_t ready_floor() {
+  return sched_clock - ( PRIO_LEVELS - 1 );
+}
+
+// a saturated process always sits in the bucket of the floor key, since
+// ready_tick moves the bucket that falls out of the window onto that one
+static int ready_bucket( pcb_t* p ) {
+  uint32_t floor = ready_floor();
+
+  if( ( int32_t )( p->key - floor ) < 0 ) {
+    return floor    & ( PRIO_LEVELS - 1 );
+  }
+  else {
+    return p->key   & ( PRIO_LEVELS - 1 );
+  }
+}
+
+void ready_insert( pcb_t* p ) {
+  p->key = p->stamp - p->base_priority;
+
+  int i = ready_bucket( p );
+
+  queue_push( &readyTab[ i ], p );
+  readyMap |= ( 1u << i );
+}
+
+void ready_remove( pcb_t* p ) {
+  int i = ready_bucket( p );
+
+  queue_remove( &readyTab[ i ], p );
+
+  if( readyTab[ i ].head == NULL ) {
+    readyMap &= ~( 1u << i );
+  }
+}
+
+pcb_t* ready_pick() {
+  if( readyMap == 0 ) {
+    return NULL;
+  }
+
+  // rotate so bit 0 corresponds to the floor (i.e., oldest, highest priority)
+  // bucket, then the first set bit is the bucket holding the smallest key
+  int      r = ready_floor() & ( PRIO_LEVELS - 1 );
+  uint32_t m = ( r == 0 ) ? readyMap : ( readyMap >> r ) | ( readyMap << ( 32 - r ) );
+  int      i = ( __builtin_ctz( m ) + r ) & ( PRIO_LEVELS - 1 );
+
+  pcb_t* p = queue_pop( &readyTab[ i ] );
+
+  if( readyTab[ i ].head == NULL ) {
+    readyMap &= ~( 1u << i );
+  }
+
+  return p;
+}
+
+// advance sched_clock, i.e., age every waiting process by one
+void ready_tick() {
+  int o = ready_floor() & ( PRIO_LEVELS - 1 ); // bucket about to leave the window
+
+  sched_clock++;
+
+  int n = ready_floor() & ( PRIO_LEVELS - 1 ); // new floor bucket
+
+  if( readyTab[ o ].head != NULL ) {
+    queue_splice( &readyTab[ n ], &readyTab[ o ] );
+
+    readyMap &= ~( 1u << o );
+    readyMap |=  ( 1u << n );
+  }
+}
+
 /******************************************************************************/
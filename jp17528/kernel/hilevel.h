@@ -17,13 +17,60 @@
 #include   "GIC.h"
 #include "PL011.h"
 #include "SP804.h"
+#include   "VFP.h"
 
 #include "lolevel.h"
 #include     "int.h"
+#include    "kmem.h"
+#include   "kheap.h"
+#include    "klog.h"
+#include      "vm.h"
+#include   "queue.h"
+#include  "bcache.h"
 
+// The process limit is set at build time (see Makefile), which also sizes
+// the kernel heap in image.ld to match: KHEAP_PAGES pages, plus three for
+// each process, i.e., its PROCESSOR_SIZE stack (mapped below VM_USER_TOP),
+// its first-level table, and its share of second-level tables and PCBs.
+// The rest backs user heaps and anything else the kernel allocates.
+#ifndef MAX_PROCS
 #define MAX_PROCS 20
+#endif
+#ifndef KHEAP_PAGES
+#define KHEAP_PAGES 256
+#endif
+#define KHEAP_NPAGES ( ( MAX_PROCS * 3 ) + KHEAP_PAGES )
+
 #define PROCESSOR_SIZE 0x00001000
 
+// Number of effective priority levels (base_priority + age) the run queues
+// can tell apart; one bit per level in a 32-bit map, so this is fixed at 32.
+// Any process whose effective priority would exceed the window saturates at
+// the top level rather than being lost.
+#define PRIO_LEVELS 32
+
+// TIMER0 counts at 1MHz, so this is the same 2^20 ticks ~= 1 sec quantum the
+// periodic tick used to give.  With TICKLESS set, timer #1 is programmed as a
+// one-shot for the next real event only (i.e., quantum expiry iff. another
+// process is waiting to run), rather than interrupting every period.
+#define QUANTUM  0x00100000
+#define TICKLESS 1
+
+// timer ticks per millisecond, as used to convert SYS_SLEEP arguments
+#define TICKS_PER_MS 1000
+
+// number of wait queues that futex addresses are hashed over
+#define FUTEX_BUCKETS 16
+
+// limits on the arguments SYS_SPAWN copies onto the stack of a new process:
+// at most SPAWN_ARGC strings, which (plus the array pointing at them) must fit
+// in SPAWN_ARGS bytes at the top of the stack
+#define SPAWN_ARGC 16
+#define SPAWN_ARGS 512
+
+// number of system call identifiers that are counted (per process)
+#define NSYSCALLS 32
+
 typedef int pid_t;
 
 typedef enum {
@@ -41,15 +88,95 @@ typedef struct {
   uint32_t cpsr, pc, gpr[ 13 ], sp, lr;
 } ctx_t;
 
-typedef struct {
+// kmem_copy_ctx copies a fixed number of bytes, so must agree
+_Static_assert( sizeof( ctx_t ) == KMEM_CTX_SIZE, "ctx_t does not match KMEM_CTX_SIZE" );
+
+// ctx must stay the first field: lolevel.s saves and restores the USR mode
+// registers in place, through the executing pointer
+typedef struct pcb_t {
+  ctx_t     ctx;
   pid_t     pid;
   status_t  status;
   uint32_t  tos;
-  ctx_t     ctx;
+  vm_t*     vm;   // address space, i.e., the user window (see vm.h)
+
+  // thread group: each thread a process creates (via SYS_THREAD_CREATE)
+  // shares its address space, and has its PID as tgid (a process being in
+  // a group of its own); tls is the value of TPIDRURO while it executes, and
+  // joinq holds the threads blocked in SYS_THREAD_JOIN until it terminates
+  pid_t     tgid;
+  uint32_t  tls;
+  queue_t   joinq;
+
+  // VFP registers, saved here only when another process takes over the VFP
+  // (so they are stale while this process is vfpOwner)
+  vfp_t     vfp;
 
   int base_priority;
-  int age;
+
+  // 'age' is not stored: it is computed lazily as (sched_clock - stamp),
+  // i.e., the number of scheduling decisions since the process last ran.
+  // 'key' = stamp - base_priority orders the run queues: a lower key means
+  // a higher effective priority (base_priority + age).
+  uint32_t stamp;
+  uint32_t key;
+
+  // run queue links (a process is in at most one queue at a time); while
+  // STATUS_TERMINATED, next instead links the PCB into the list of those
+  // still to be freed
+  struct pcb_t* next;
+  struct pcb_t* prev;
+
+  // while STATUS_WAITING: the queue the process is blocked on, plus the
+  // timer_now() value at which a sleeping process should be woken
+  struct queue_t* wq;
+  uint32_t wake;
+
+  // while blocked in SYS_FUTEX_WAIT: the user address waited on
+  uint32_t futex;
+
+  // bytes already transferred by a blocking system call that is restarted
+  // (i.e., re-issued for the remainder) each time the process is woken
+  uint32_t io_done;
+
+  // set while a system call that blocked is re-issued, so that it is only
+  // counted (as a call, and as a voluntary context switch) once
+  bool     restarted;
+
+  // accounting, as reported by SYS_PS: times are in timer ticks, and since is
+  // the timer_now() value when the process last started executing or waiting
+  uint64_t cpu_time;
+  uint64_t wait_time;
+  uint32_t since;
+  uint32_t nvcsw;                   // voluntary   context switches (gave up the processor)
+  uint32_t nivcsw;                  // involuntary context switches (were preempted)
+  uint32_t syscalls[ NSYSCALLS ];   // system calls made, by identifier
 
 } pcb_t;
 
+// the snapshot of a process SYS_PS returns: this must match the procstat_t
+// user programs see (in libc.h), and times are in milliseconds
+typedef struct {
+  pid_t    pid;
+  pid_t    tgid;
+  int      status;     // i.e., a status_t, which may be narrower than an int
+  int      base_priority;
+  uint32_t cpu_time;
+  uint32_t wait_time;
+  uint32_t nvcsw;
+  uint32_t nivcsw;
+  uint32_t syscalls[ NSYSCALLS ];
+} procstat_t;
+
+// i.e., 8 words then the syscall counts, as libc.h lays them out
+_Static_assert( sizeof( procstat_t ) == ( 8 + NSYSCALLS ) * sizeof( uint32_t ), "procstat_t does not match libc.h" );
+
+// a buffered UART, plus the processes blocked until it can be read from or
+// written to (i.e., until its receive ring fills or its transmit ring drains)
+typedef struct {
+  PL011_buf_t buf;
+  queue_t     rxq;
+  queue_t     txq;
+} uart_t;
+
 #endif
@@ -0,0 +1,228 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "kheap.h"
+#include "hilevel.h" // for KHEAP_NPAGES, which bounds the page pool
+
+// page i lives at kheap_base + i * KPAGE_SIZE; kheap_owner[ i ] is the cache
+// page i is a slab of, or NULL if it was allocated as a page
+uint8_t*  kheap_base = NULL;
+int       kheap_npages = 0;
+void*     kheap_free = NULL;
+kcache_t* kheap_owner[ KHEAP_NPAGES ];
+
+uint32_t  kheap_used   = 0;
+uint32_t  kheap_allocs = 0;
+uint32_t  kheap_fails  = 0;
+
+// every cache, in the order they were set up
+kcache_t* kheap_caches = NULL;
+
+// the kmalloc size classes, i.e., KMALLOC_MIN, 2 * KMALLOC_MIN, ... KMALLOC_MAX
+kcache_t  kmallocTab[ 7 ];
+
+const char* kmallocName[ 7 ] = {
+  "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256", "kmalloc-512",
+  "kmalloc-1024", "kmalloc-2048"
+};
+
+void kheap_init( void* x, void* y ) {
+  uint32_t lo = ( ( uint32_t )( x ) + KPAGE_SIZE - 1 ) & ~( KPAGE_SIZE - 1 );
+  uint32_t hi = ( ( uint32_t )( y )                  ) & ~( KPAGE_SIZE - 1 );
+
+  kheap_base   = ( uint8_t* )( lo );
+  kheap_npages = ( hi - lo ) / KPAGE_SIZE;
+
+  if( kheap_npages > KHEAP_NPAGES ) {
+    kheap_npages = KHEAP_NPAGES;
+  }
+
+  // pushed in reverse, so that the lowest page is allocated first
+  for( int i = kheap_npages - 1; i >= 0; i-- ) {
+    void* p = kheap_base + i * KPAGE_SIZE;
+
+    *( void** )( p ) = kheap_free; kheap_free = p;
+  }
+
+  for( int i = 0; i < 7; i++ ) {
+    kcache_init( &kmallocTab[ i ], kmallocName[ i ], KMALLOC_MIN << i );
+  }
+}
+
+void* kpage_alloc() {
+  void* x = kheap_free;
+
+  if( x == NULL ) {
+    kheap_fails++; return NULL;
+  }
+
+  kheap_free = *( void** )( x );
+
+  kheap_owner[ kpage_index( x ) ] = NULL;
+
+  kheap_used++; kheap_allocs++;
+
+  return x;
+}
+
+void kpage_free( void* x ) {
+  *( void** )( x ) = kheap_free; kheap_free = x;
+
+  kheap_used--;
+}
+
+int kpage_index( void* x ) {
+  return ( ( uint8_t* )( x ) - kheap_base ) / KPAGE_SIZE;
+}
+
+int kheap_pages() {
+  return kheap_npages;
+}
+
+void kcache_init( kcache_t* c, const char* name, size_t n ) {
+  // each object must be able to hold the free list link, and stay 8-byte
+  // aligned (e.g., for ldrd/strd and vldm/vstm)
+  n = ( n + 7 ) & ~7;
+
+  c->name   = name;
+  c->size   = ( n < sizeof( void* ) ) ? sizeof( void* ) : n;
+  c->free   = NULL;
+  c->slabs  = 0;
+  c->used   = 0;
+  c->avail  = 0;
+  c->allocs = 0;
+  c->fails  = 0;
+  c->next   = NULL;
+
+  kcache_t** t = &kheap_caches;
+
+  while( *t != NULL ) {
+    t = &( *t )->next;
+  }
+
+  *t = c;
+}
+
+// add a slab, i.e., a page worth of objects, to c
+static bool kcache_grow( kcache_t* c ) {
+  uint8_t* x = kpage_alloc();
+
+  if( x == NULL ) {
+    return false;
+  }
+
+  kheap_owner[ kpage_index( x ) ] = c;
+
+  int n = KPAGE_SIZE / c->size;
+
+  // pushed in reverse, so that objects are handed out in address order
+  for( int i = n - 1; i >= 0; i-- ) {
+    void* y = x + i * c->size;
+
+    *( void** )( y ) = c->free; c->free = y;
+  }
+
+  c->slabs++;
+  c->avail += n;
+
+  return true;
+}
+
+void* kcache_alloc( kcache_t* c ) {
+  if( c->free == NULL && !kcache_grow( c ) ) {
+    c->fails++; return NULL;
+  }
+
+  void* x = c->free;
+
+  c->free = *( void** )( x );
+
+  c->avail--; c->used++; c->allocs++;
+
+  return x;
+}
+
+void kcache_free( kcache_t* c, void* x ) {
+  *( void** )( x ) = c->free; c->free = x;
+
+  c->avail++; c->used--;
+}
+
+void* kmalloc( size_t n ) {
+  if( n > KMALLOC_MAX ) {
+    return ( n <= KPAGE_SIZE ) ? kpage_alloc() : NULL;
+  }
+
+  int i = 0;
+
+  while( ( KMALLOC_MIN << i ) < n ) {
+    i++;
+  }
+
+  return kcache_alloc( &kmallocTab[ i ] );
+}
+
+void kfree( void* x ) {
+  if( x == NULL ) {
+    return;
+  }
+
+  kcache_t* c = kheap_owner[ kpage_index( x ) ];
+
+  if( c == NULL ) {
+    kpage_free( x );
+  }
+  else {
+    kcache_free( c, x );
+  }
+}
+
+static void kheap_name( slabstat_t* x, const char* y ) {
+  int i = 0;
+
+  while( i < ( sizeof( x->name ) - 1 ) && y[ i ] != '\x00' ) {
+    x->name[ i ] = y[ i ]; i++;
+  }
+
+  x->name[ i ] = '\x00';
+}
+
+bool kheap_stat( int i, slabstat_t* x ) {
+  if( i == 0 ) {
+    kheap_name( x, "page" );
+
+    x->size   = KPAGE_SIZE;
+    x->slabs  = kheap_npages;
+    x->used   = kheap_used;
+    x->avail  = kheap_npages - kheap_used;
+    x->allocs = kheap_allocs;
+    x->fails  = kheap_fails;
+
+    return true;
+  }
+
+  kcache_t* c = kheap_caches;
+
+  while( c != NULL && --i > 0 ) {
+    c = c->next;
+  }
+
+  if( c == NULL ) {
+    return false;
+  }
+
+  kheap_name( x, c->name );
+
+  x->size   = c->size;
+  x->slabs  = c->slabs;
+  x->used   = c->used;
+  x->avail  = c->avail;
+  x->allocs = c->allocs;
+  x->fails  = c->fails;
+
+  return true;
+}
@@ -0,0 +1,91 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __KHEAP_H
+#define __KHEAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kmem.h"
+
+/* The kernel heap is the region image.ld reserves between bos_kheap and
+ * tos_kheap, carved into pages.  Free pages are kept in a list, linked
+ * through their first word, so allocating or freeing one is constant time;
+ * since every allocation is a whole page, the heap never fragments.
+ *
+ * Objects smaller than a page come from slab caches on top: each cache hands
+ * out objects of one size from pages it takes from the page allocator (one
+ * slab per page), and keeps the objects freed in its own list.  Slabs are
+ * never given back, so a cache is as large as its peak use, but allocating
+ * and freeing an object is constant time too.  There is a cache per type
+ * that needs one (e.g., PCBs), plus size classes behind kmalloc for anything
+ * else (e.g., I/O buffers).
+ */
+
+#define KPAGE_SIZE  0x00001000
+
+// smallest and largest kmalloc size classes (each a power of 2)
+#define KMALLOC_MIN 32
+#define KMALLOC_MAX 2048
+
+typedef struct kcache_t {
+  const char* name;
+  uint32_t    size;    // bytes per object
+  void*       free;    // free objects, linked through their first word
+
+  uint32_t    slabs;   // pages taken from the page allocator
+  uint32_t    used;    // objects allocated and not yet freed
+  uint32_t    avail;   // objects free, i.e., in the list
+  uint32_t    allocs;  // allocations that succeeded
+  uint32_t    fails;   // allocations that failed, for lack of pages
+
+  struct kcache_t* next; // every cache, as enumerated by kheap_stat
+} kcache_t;
+
+// the statistics SYS_SLAB returns for one cache: this must match the
+// slabstat_t user programs see (in libc.h)
+typedef struct {
+  char     name[ 16 ];
+  uint32_t size;
+  uint32_t slabs;
+  uint32_t used;
+  uint32_t avail;
+  uint32_t allocs;
+  uint32_t fails;
+} slabstat_t;
+
+// carve [ x, y ) into pages, then set up the kmalloc size classes
+extern void  kheap_init( void* x, void* y );
+
+// allocate a page (4KB aligned), or return NULL if there is none free
+extern void* kpage_alloc();
+// free page x
+extern void  kpage_free( void* x );
+// the index of the page holding x, i.e., 0 to kheap_pages() - 1
+extern int   kpage_index( void* x );
+// the number of pages in the heap
+extern int   kheap_pages();
+
+// set up an (empty) cache c of objects of n bytes each (at most a page)
+extern void  kcache_init( kcache_t* c, const char* name, size_t n );
+// allocate an object from c, or return NULL if c is empty and no page is free
+extern void* kcache_alloc( kcache_t* c );
+// free object x, which was allocated from c
+extern void  kcache_free ( kcache_t* c, void* x );
+
+// allocate n bytes (at most a page), 8-byte aligned, or return NULL
+extern void* kmalloc( size_t n );
+// free x, which was allocated via kmalloc, unless it is NULL
+extern void  kfree  ( void* x );
+
+// copy the statistics of the i-th cache into x, where the 0-th is the page
+// allocator itself; false if there is no such cache
+extern bool  kheap_stat( int i, slabstat_t* x );
+
+#endif
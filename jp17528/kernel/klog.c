@@ -0,0 +1,116 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "klog.h"
+
+klog_rec_t klog_ring[ KLOG_SIZE ];
+
+// records [ klog_tail, klog_head ) are pending; both only ever increase
+uint32_t   klog_head    = 0;
+uint32_t   klog_tail    = 0;
+uint32_t   klog_dropped = 0;
+
+PL011_buf_t* klog_uart = NULL;
+
+void klog_init( PL011_buf_t* b ) {
+  klog_uart = b;
+}
+
+void klog_put( klog_type_t t, uint16_t a, uint16_t b ) {
+  if( ( klog_head - klog_tail ) == KLOG_SIZE ) {
+    klog_dropped++; return;
+  }
+
+  klog_rec_t* r = &klog_ring[ klog_head++ & ( KLOG_SIZE - 1 ) ];
+
+  r->type = t;
+  r->a    = a;
+  r->b    = b;
+
+  klog_drain();
+}
+
+static int klog_puts( char* x, const char* y ) {
+  int n = 0;
+
+  while( *y != '\x00' ) {
+    x[ n++ ] = *y++;
+  }
+
+  return n;
+}
+
+static int klog_putn( char* x, uint16_t y ) {
+  int n = 0;
+
+  if( y == KLOG_NONE ) {
+    return klog_puts( x, "?"    );
+  }
+  if( y == KLOG_IDLE ) {
+    return klog_puts( x, "idle" );
+  }
+
+  if( y >= 10000 ) {
+    x[ n++ ] = '0' + ( y / 10000 );
+  }
+  if( y >=  1000 ) {
+    x[ n++ ] = '0' + ( y /  1000 ) % 10;
+  }
+  if( y >=   100 ) {
+    x[ n++ ] = '0' + ( y /   100 ) % 10;
+  }
+  if( y >=    10 ) {
+    x[ n++ ] = '0' + ( y /    10 ) % 10;
+  }
+    x[ n++ ] = '0' + ( y /     1 ) % 10;
+
+  return n;
+}
+
+// render record r as text, in the format the kernel has always printed
+static int klog_format( char* x, klog_rec_t* r ) {
+  int n = 0;
+
+  switch( r->type ) {
+    case KLOG_FORK     : n += klog_puts( x + n, "[FORK]\n"    ); break;
+    case KLOG_EXIT     : n += klog_puts( x + n, "[EXIT]"      ); break;
+    case KLOG_EXEC     : n += klog_puts( x + n, "[EXECUTE]"   ); break;
+    case KLOG_SPAWN    : n += klog_puts( x + n, "[SPAWN]"     ); break;
+    case KLOG_THREAD   : n += klog_puts( x + n, "[THREAD]"    ); break;
+    case KLOG_KILL     : n += klog_puts( x + n, "[KILL]"      ); break;
+    case KLOG_NICE     : n += klog_puts( x + n, "[NICE]"      ); break;
+    case KLOG_FAULT    : n += klog_puts( x + n, "[FAULT]"     ); break;
+    case KLOG_YIELD    : n += klog_puts( x + n, "[YIELD]"     ); break;
+    case KLOG_TIMER    : n += klog_puts( x + n, "[TIMER]\n"   ); break;
+
+    case KLOG_DISPATCH : {
+      n += klog_puts( x + n, "["     );
+      n += klog_putn( x + n, r->a    );
+      n += klog_puts( x + n, "->"    );
+      n += klog_putn( x + n, r->b    );
+      n += klog_puts( x + n, "]\n"   );
+      break;
+    }
+  }
+
+  return n;
+}
+
+void klog_drain() {
+  char x[ 24 ]; // long enough for any one record
+
+  while( klog_uart != NULL && klog_tail != klog_head ) {
+    int n = klog_format( x, &klog_ring[ klog_tail & ( KLOG_SIZE - 1 ) ] );
+
+    // never split a record, so it is not interleaved with other output
+    if( PL011_buf_space( klog_uart ) < n ) {
+      return;
+    }
+
+    PL011_buf_write( klog_uart, ( uint8_t* )( x ), n ); klog_tail++;
+  }
+}
@@ -0,0 +1,88 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __KLOG_H
+#define __KLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "PL011.h"
+
+/* Kernel log messages (e.g., [FORK] or [1->2]) are not written to UART0 as
+ * they are produced: rather, klog appends a fixed-size binary record to a
+ * ring buffer, and the records are formatted into the UART0 transmit ring
+ * whenever it has space, to be written out by the PL011 TX interrupt.  So
+ * the kernel never waits on the UART while interrupts are masked; if the
+ * ring fills, further records are dropped (and counted) rather than waited
+ * for.
+ *
+ * Verbosity is fixed at build time via KLOG_LEVEL (see Makefile): a message
+ * is recorded iff. its level is at most KLOG_LEVEL, and otherwise compiled
+ * out altogether.
+ *
+ * 0 : nothing
+ * 1 : process life-cycle, i.e., fork, exit, exec, spawn, thread, kill, nice
+ *     and faults
+ * 2 : as 1, plus context switches and yields
+ * 3 : as 2, plus timer interrupts
+ */
+
+#ifndef KLOG_LEVEL
+#define KLOG_LEVEL 3
+#endif
+
+// number of records the ring buffer holds; must be a power of 2
+#define KLOG_SIZE 64
+
+typedef enum {
+  KLOG_FORK,
+  KLOG_EXIT,
+  KLOG_EXEC,
+  KLOG_SPAWN,
+  KLOG_THREAD,
+  KLOG_KILL,
+  KLOG_NICE,
+  KLOG_FAULT,
+
+  KLOG_DISPATCH,
+  KLOG_YIELD,
+
+  KLOG_TIMER
+} klog_type_t;
+
+typedef struct {
+  uint16_t type, a, b, c;
+} klog_rec_t;
+
+// an argument with no value, e.g., the previous PID of the first dispatch
+#define KLOG_NONE 0xFFFF
+// a PID argument denoting the idle process
+#define KLOG_IDLE 0xFFFE
+
+#define KLOG_LEVEL_OF( t ) ( ( ( t ) >= KLOG_TIMER    ) ? 3 : \
+                             ( ( t ) >= KLOG_DISPATCH ) ? 2 : 1 )
+
+// record message t with arguments a and b (e.g., the PIDs of a dispatch)
+#define klog( t, a, b ) do {                    \
+  if( KLOG_LEVEL_OF( t ) <= KLOG_LEVEL ) {      \
+    klog_put( ( t ), ( a ), ( b ) );            \
+  }                                             \
+} while( 0 )
+
+// drain the ring buffer into (the transmit ring of) buffered PL011 instance b
+extern void klog_init( PL011_buf_t* b );
+// append a record to the ring buffer, then start draining it
+extern void klog_put( klog_type_t t, uint16_t a, uint16_t b );
+// move as many records as fit into the transmit ring, without blocking
+extern void klog_drain();
+
+// number of records dropped because the ring buffer was full
+extern uint32_t klog_dropped;
+
+#endif
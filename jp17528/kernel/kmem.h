@@ -0,0 +1,51 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __KMEM_H
+#define __KMEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Copy and clear routines tuned for the Cortex-A8, which the kernel uses in
+ * place of memcpy and memset from libc: they move 32 bytes per ldm/stm
+ * burst, prefetch (via pld) a line or two ahead, and have fixed-size paths
+ * for the two copies that dominate, i.e., a ctx_t and a page (a page being
+ * PROCESSOR_SIZE, i.e., one stack frame or one first-level table).
+ *
+ * If KMEM_NEON is set (see Makefile), kmem_copy_page moves 64 bytes at a time
+ * through D0-D7.  It enables the VFP just for the copy, and preserves those
+ * registers, so the (lazily switched) state of vfpOwner is left intact.
+ *
+ * user/MB.c measures, from USR mode, the kernel paths that use them against
+ * libc doing the same work.
+ */
+
+// the size of a ctx_t, as copied by kmem_copy_ctx
+#define KMEM_CTX_SIZE  68
+// the size of a page, as copied by kmem_copy_page
+#define KMEM_PAGE_SIZE 0x00001000
+
+// copy n bytes from y to x, which must not overlap; defers to memcpy unless
+// both are word aligned
+extern void kmem_copy( void* x, const void* y, size_t n );
+// set n bytes at x to 0
+extern void kmem_clear( void* x, size_t n );
+
+// copy a ctx_t from y to x, both word aligned
+extern void kmem_copy_ctx ( void* x, const void* y );
+// copy a page from y to x, both word aligned, via NEON iff. KMEM_NEON
+extern void kmem_copy_page( void* x, const void* y );
+
+// as kmem_copy_page, via ldm/stm only
+extern void kmem_copy_page_arm ( void* x, const void* y );
+// as kmem_copy_page, via NEON only: the caller must have the VFP enabled, and
+// D0-D7 are corrupted (as per the AAPCS, i.e., they are caller-saved)
+extern void kmem_copy_page_neon( void* x, const void* y );
+
+#endif
@@ -0,0 +1,156 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+/* The Cortex-A8 has 64-byte cache lines, and its load/store unit does best
+ * with long ldm/stm (or vldm/vstm) bursts: each loop below moves one line
+ * per iteration, and uses pld to have the next line or two on its way while
+ * the current one is copied.  See kmem.h for how each routine is used.
+ */
+
+.fpu neon
+
+.ifndef KMEM_NEON
+.set    KMEM_NEON, 1
+.endif
+
+.global kmem_copy
+.global kmem_clear
+
+.global kmem_copy_ctx
+.global kmem_copy_page
+
+.global kmem_copy_page_arm
+.global kmem_copy_page_neon
+
+kmem_copy:           orr   r3, r0, r1
+                     tst   r3, #0x3              @ test  x or y not word aligned
+                     bne   memcpy                @ defer to libc if so
+
+                     push  { r4-r10 }
+
+                     subs  r2, r2, #32
+                     blt   l_copy_tail
+l_copy_burst:        pld   [ r1, #64 ]           @ prefetch next line
+                     ldmia r1!, { r3-r10 }       @ load  32 bytes, inc. source      address
+                     stmia r0!, { r3-r10 }       @ store 32 bytes, inc. destination address
+                     subs  r2, r2, #32
+                     bge   l_copy_burst          @ loop if >= 32 bytes left
+
+l_copy_tail:         add   r2, r2, #32           @ compute bytes left, i.e., < 32
+                     pop   { r4-r10 }
+
+l_copy_word:         cmp   r2, #4
+                     blo   l_copy_byte
+                     ldr   r3, [ r1 ], #4        @ load  word, inc. source      address
+                     str   r3, [ r0 ], #4        @ store word, inc. destination address
+                     sub   r2, r2, #4
+                     b     l_copy_word           @ loop if >= 4 bytes left
+
+l_copy_byte:         cmp   r2, #0
+                     beq   l_copy_done
+                     ldrb  r3, [ r1 ], #1        @ load  byte, inc. source      address
+                     strb  r3, [ r0 ], #1        @ store byte, inc. destination address
+                     sub   r2, r2, #1
+                     b     l_copy_byte           @ loop if >= 1 byte  left
+
+l_copy_done:         mov   pc, lr                @ return
+
+kmem_clear:          mov   r2, #0
+
+l_clear_head:        tst   r0, #0x3
+                     beq   l_clear_body          @ skip  once x is word aligned
+                     cmp   r1, #0
+                     beq   l_clear_done
+                     strb  r2, [ r0 ], #1        @ store byte, inc. destination address
+                     sub   r1, r1, #1
+                     b     l_clear_head
+
+l_clear_body:        push  { r4-r9 }
+                     mov   r3, #0
+                     mov   r4, #0
+                     mov   r5, #0
+                     mov   r6, #0
+                     mov   r7, #0
+                     mov   r8, #0
+                     mov   r9, #0
+
+                     subs  r1, r1, #32
+                     blt   l_clear_tail
+l_clear_burst:       stmia r0!, { r2-r9 }        @ store 32 bytes, inc. destination address
+                     subs  r1, r1, #32
+                     bge   l_clear_burst         @ loop if >= 32 bytes left
+
+l_clear_tail:        add   r1, r1, #32           @ compute bytes left, i.e., < 32
+                     pop   { r4-r9 }
+
+l_clear_word:        cmp   r1, #4
+                     blo   l_clear_byte
+                     str   r2, [ r0 ], #4        @ store word, inc. destination address
+                     sub   r1, r1, #4
+                     b     l_clear_word          @ loop if >= 4 bytes left
+
+l_clear_byte:        cmp   r1, #0
+                     beq   l_clear_done
+                     strb  r2, [ r0 ], #1        @ store byte, inc. destination address
+                     sub   r1, r1, #1
+                     b     l_clear_byte          @ loop if >= 1 byte  left
+
+l_clear_done:        mov   pc, lr                @ return
+
+kmem_copy_ctx:       push  { r4-r10 }
+
+                     ldmia r1!, { r2-r10 }       @ load  CPSR, PC, r0-r6
+                     stmia r0!, { r2-r10 }       @ store CPSR, PC, r0-r6
+                     ldmia r1,  { r2-r9  }       @ load  r7-r12, SP, LR
+                     stmia r0,  { r2-r9  }       @ store r7-r12, SP, LR
+
+                     pop   { r4-r10 }
+
+                     mov   pc, lr                @ return
+
+kmem_copy_page:
+.if KMEM_NEON
+                     push  { r4, lr }
+
+                     vmrs  r4, fpexc             @ read  FPEXC
+                     orr   r3, r4, #0x40000000   @ set   FPEXC[ EN ] = 1 =>  enable
+                     vmsr  fpexc, r3             @ write FPEXC
+                     vpush { d0-d7 }             @ preserve D0-D7, i.e., the state of vfpOwner
+
+                     bl    kmem_copy_page_neon
+
+                     vpop  { d0-d7 }             @ restore  D0-D7
+                     vmsr  fpexc, r4             @ restore FPEXC
+
+                     pop   { r4, pc }            @ return
+.else
+                     b     kmem_copy_page_arm
+.endif
+
+kmem_copy_page_arm:  push  { r4-r10 }
+
+                     mov   r2, #0x1000
+l_page_arm:          pld   [ r1, #128 ]          @ prefetch line after next
+                     ldmia r1!, { r3-r10 }       @ load  32 bytes, inc. source      address
+                     stmia r0!, { r3-r10 }       @ store 32 bytes, inc. destination address
+                     ldmia r1!, { r3-r10 }       @ load  32 bytes, inc. source      address
+                     stmia r0!, { r3-r10 }       @ store 32 bytes, inc. destination address
+                     subs  r2, r2, #64
+                     bne   l_page_arm            @ loop if any line left
+
+                     pop   { r4-r10 }
+
+                     mov   pc, lr                @ return
+
+kmem_copy_page_neon: mov   r2, #0x1000
+l_page_neon:         pld   [ r1, #192 ]          @ prefetch 3 lines ahead
+                     vldmia r1!, { d0-d7 }       @ load  64 bytes, inc. source      address
+                     vstmia r0!, { d0-d7 }       @ store 64 bytes, inc. destination address
+                     subs  r2, r2, #64
+                     bne   l_page_neon           @ loop if any line left
+
+                     mov   pc, lr                @ return
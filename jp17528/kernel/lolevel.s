@@ -8,53 +8,133 @@
 .global lolevel_handler_rst
 .global lolevel_handler_irq
 .global lolevel_handler_svc
+.global lolevel_handler_abt
+.global lolevel_handler_und
+
+/* Rather than build a context frame on the stack and have the high-level C
+ * functions copy it into and out of a PCB, the handlers below save the USR
+ * mode registers directly into, and restore them directly from, the ctx_t
+ * at the start of the PCB that executing points at.  A context switch is
+ * then just the high-level code changing executing.
+ */
 
 lolevel_handler_rst: bl    int_init                @ initialise interrupt vector table
 
                      msr   cpsr, #0xD2             @ enter IRQ mode with IRQ and FIQ interrupts disabled
                      ldr   sp, =tos_irq            @ initialise IRQ mode stack
+                     msr   cpsr, #0xD7             @ enter ABT mode with IRQ and FIQ interrupts disabled
+                     ldr   sp, =tos_abt            @ initialise ABT mode stack
+                     msr   cpsr, #0xDB             @ enter UND mode with IRQ and FIQ interrupts disabled
+                     ldr   sp, =tos_und            @ initialise UND mode stack
                      msr   cpsr, #0xD3             @ enter SVC mode with IRQ and FIQ interrupts disabled
                      ldr   sp, =tos_svc            @ initialise SVC mode stack
 
-                     sub   sp, sp, #68             @ initialise dummy context
-
-                     mov   r0, sp                  @ set    high-level C function arg. = SP
                      bl    hilevel_handler_rst     @ invoke high-level C function
 
-                     ldmia sp!, { r0, lr }         @ load     USR mode PC and CPSR
-                     msr   spsr, r0                @ move     USR mode        CPSR
-                     ldmia sp, { r0-r12, sp, lr }^ @ restore  USR mode registers
-                     add   sp, sp, #60             @ update   SVC mode SP
+                     ldr   r0, =executing
+                     ldr   r0, [ r0 ]              @ load     &executing->ctx
+                     ldmia r0!, { r1, lr }         @ load     USR mode CPSR and PC
+                     msr   spsr, r1                @ move     USR mode        CPSR
+                     ldmia r0, { r0-r12, sp, lr }^ @ restore  USR mode registers
                      movs  pc, lr                  @ return from interrupt
 
 lolevel_handler_irq: sub   lr, lr, #4              @ correct return address
-                     sub   sp, sp, #60             @ update   SVC mode stack
-                     stmia sp, { r0-r12, sp, lr }^ @ preserve USR registers
-                     mrs   r0, spsr                @ move     USR        CPSR
-                     stmdb sp!, { r0, lr }         @ store    USR PC and CPSR
-
-                     mov   r0, sp                  @ set    high-level C function arg. = SP
-                     bl    hilevel_handler_irq     @ invoke high-level C function
-
-                     ldmia sp!, { r0, lr }         @ load     USR mode PC and CPSR
-                     msr   spsr, r0                @ move     USR mode        CPSR
-                     ldmia sp, { r0-r12, sp, lr }^ @ restore  USR mode registers
-                     add   sp, sp, #60             @ update   SVC mode SP
+                     str   r0, [ sp, #-4 ]!        @ stash    USR r0
+                     ldr   r0, =executing
+                     ldr   r0, [ r0 ]              @ load     &executing->ctx
+                     add   r0, r0, #8              @ skip     CPSR and PC
+                     stmia r0, { r0-r12, sp, lr }^ @ preserve USR registers
+                     ldr   r1, [ sp ], #4          @ unstash  USR r0
+                     str   r1, [ r0 ]              @ preserve USR r0
+                     mrs   r1, spsr                @ move     USR        CPSR
+                     stmdb r0!, { r1, lr }         @ preserve USR CPSR and PC
+
+                     bl    hilevel_handler_irq     @ invoke high-level C function, arg. = &executing->ctx
+
+                     ldr   r0, =executing
+                     ldr   r0, [ r0 ]              @ load     &executing->ctx (which may have changed)
+                     ldmia r0!, { r1, lr }         @ load     USR mode CPSR and PC
+                     msr   spsr, r1                @ move     USR mode        CPSR
+                     ldmia r0, { r0-r12, sp, lr }^ @ restore  USR mode registers
                      movs  pc, lr                  @ return from interrupt
 
 lolevel_handler_svc: sub   lr, lr, #0              @ correct return address
-                     sub   sp, sp, #60             @ update   SVC mode stack
-                     stmia sp, { r0-r12, sp, lr }^ @ preserve USR registers
-                     mrs   r0, spsr                @ move     USR        CPSR
-                     stmdb sp!, { r0, lr }         @ store    USR PC and CPSR
+                     str   r0, [ sp, #-4 ]!        @ stash    USR r0
+                     ldr   r0, =executing
+                     ldr   r0, [ r0 ]              @ load     &executing->ctx
+                     add   r0, r0, #8              @ skip     CPSR and PC
+                     stmia r0, { r0-r12, sp, lr }^ @ preserve USR registers
+                     ldr   r1, [ sp ], #4          @ unstash  USR r0
+                     str   r1, [ r0 ]              @ preserve USR r0
+                     mrs   r1, spsr                @ move     USR        CPSR
+                     stmdb r0!, { r1, lr }         @ preserve USR CPSR and PC
 
-                     mov   r0, sp                  @ set    high-level C function arg. = SP
                      ldr   r1, [ lr, #-4 ]         @ load                     svc instruction
                      bic   r1, r1, #0xFF000000     @ set    high-level C function arg. = svc immediate
-                     bl    hilevel_handler_svc     @ invoke high-level C function
+                     bl    hilevel_handler_svc     @ invoke high-level C function, arg. = &executing->ctx
+
+                     ldr   r0, =executing
+                     ldr   r0, [ r0 ]              @ load     &executing->ctx (which may have changed)
+                     ldmia r0!, { r1, lr }         @ load     USR mode CPSR and PC
+                     msr   spsr, r1                @ move     USR mode        CPSR
+                     ldmia r0, { r0-r12, sp, lr }^ @ restore  USR mode registers
+                     movs  pc, lr                  @ return from interrupt
+
+/* A data abort is only expected from USR mode (e.g., a write to a stack page
+ * shared copy-on-write after fork); one taken by the kernel itself is a bug,
+ * so it halts as every abort did before.  The faulting instruction is
+ * re-executed on return, unless the high-level code terminates the process.
+ */
+
+lolevel_handler_abt: sub   lr, lr, #8              @ correct return address (i.e., re-execute)
+                     str   r0, [ sp, #-4 ]!        @ stash    USR r0
+                     mrs   r0, spsr                @ move     aborted    CPSR
+                     tst   r0, #0xF                @ test     aborted    mode == USR
+                     bne   .                       @ halt     if not
+                     ldr   r0, =executing
+                     ldr   r0, [ r0 ]              @ load     &executing->ctx
+                     add   r0, r0, #8              @ skip     CPSR and PC
+                     stmia r0, { r0-r12, sp, lr }^ @ preserve USR registers
+                     ldr   r1, [ sp ], #4          @ unstash  USR r0
+                     str   r1, [ r0 ]              @ preserve USR r0
+                     mrs   r1, spsr                @ move     USR        CPSR
+                     stmdb r0!, { r1, lr }         @ preserve USR CPSR and PC
+
+                     bl    hilevel_handler_abt     @ invoke high-level C function, arg. = &executing->ctx
+
+                     ldr   r0, =executing
+                     ldr   r0, [ r0 ]              @ load     &executing->ctx (which may have changed)
+                     ldmia r0!, { r1, lr }         @ load     USR mode CPSR and PC
+                     msr   spsr, r1                @ move     USR mode        CPSR
+                     ldmia r0, { r0-r12, sp, lr }^ @ restore  USR mode registers
+                     movs  pc, lr                  @ return from interrupt
+
+/* An undefined instruction is likewise only expected from USR mode, where
+ * it is usually a VFP or Advanced SIMD instruction executed while FPEXC.EN
+ * is clear (see hilevel_handler_und).  User programs are ARM code, so the
+ * instruction is 4 bytes before the return address; it is re-executed on
+ * return, unless the high-level code terminates the process.
+ */
+
+lolevel_handler_und: sub   lr, lr, #4              @ correct return address (i.e., re-execute)
+                     str   r0, [ sp, #-4 ]!        @ stash    USR r0
+                     mrs   r0, spsr                @ move     trapped    CPSR
+                     tst   r0, #0xF                @ test     trapped    mode == USR
+                     bne   .                       @ halt     if not
+                     ldr   r0, =executing
+                     ldr   r0, [ r0 ]              @ load     &executing->ctx
+                     add   r0, r0, #8              @ skip     CPSR and PC
+                     stmia r0, { r0-r12, sp, lr }^ @ preserve USR registers
+                     ldr   r1, [ sp ], #4          @ unstash  USR r0
+                     str   r1, [ r0 ]              @ preserve USR r0
+                     mrs   r1, spsr                @ move     USR        CPSR
+                     stmdb r0!, { r1, lr }         @ preserve USR CPSR and PC
+
+                     bl    hilevel_handler_und     @ invoke high-level C function, arg. = &executing->ctx
 
-                     ldmia sp!, { r0, lr }         @ load     USR mode PC and CPSR
-                     msr   spsr, r0                @ move     USR mode        CPSR
-                     ldmia sp, { r0-r12, sp, lr }^ @ restore  USR mode registers
-                     add   sp, sp, #60             @ update   SVC mode SP
+                     ldr   r0, =executing
+                     ldr   r0, [ r0 ]              @ load     &executing->ctx (which may have changed)
+                     ldmia r0!, { r1, lr }         @ load     USR mode CPSR and PC
+                     msr   spsr, r1                @ move     USR mode        CPSR
+                     ldmia r0, { r0-r12, sp, lr }^ @ restore  USR mode registers
                      movs  pc, lr                  @ return from interrupt
@@ -0,0 +1,29 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __QUEUE_H
+#define __QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A queue of processes, linked through the next and prev fields of each PCB
+// (see hilevel.h): e.g., those ready to execute at some priority, or blocked
+// until some event.  It lives apart from the PCB so that anything the kernel
+// blocks processes on (e.g., a block cache buffer) can embed one.
+typedef struct queue_t {
+  struct pcb_t* head;
+  struct pcb_t* tail;
+} queue_t;
+
+// block the executing process on wait queue q, then pick another to execute
+extern void block   ( queue_t* q );
+// make every process blocked on wait queue q ready again
+extern void wake_all( queue_t* q );
+
+#endif
@@ -0,0 +1,370 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "vm.h"
+#include "hilevel.h" // for KHEAP_NPAGES, which bounds the frame pool
+
+// first-level descriptors (per Section B3.5.1 of the ARMv7-A ARM): devices
+// are privileged-only and never executable, RAM is write-back cacheable, and
+// anything else is normal but non-cacheable memory
+#define L1_DEVICE  0x00000416 // section, AP = 01, XN, TEX:C:B = 000:0:1 (shared device)
+#define L1_MEMORY  0x00001C02 // section, AP = 11,     TEX:C:B = 001:0:0 (normal, non-cacheable)
+#define L1_CACHED  0x00001C0E // section, AP = 11,     TEX:C:B = 001:1:1 (normal, write-back, write-allocate)
+#define L1_COARSE  0x00000001 // second-level page table, domain 0
+
+// second-level descriptors: small pages of stack belong to one process (so
+// are non-global), are never executable, and are read-only (for both
+// privileged and user accesses) while shared
+#define L2_PAGE    0x0000084F // small page, nG, XN, TEX:C:B = 001:1:1 (normal, write-back, write-allocate)
+#define L2_RW      0x00000030 // AP[2] = 0, AP[1:0] = 11
+#define L2_RO      0x00000230 // AP[2] = 1, AP[1:0] = 11
+#define L2_AP      0x00000230
+
+#define L2_FRAME( x ) ( ( uint8_t* )( ( x ) & ~( VM_PAGE_SIZE - 1 ) ) )
+
+#define VM_ASIDS   255
+
+/* With the caches enabled, page table writes may sit in the data cache,
+ * whereas (with TTBRx.RGN = TTBRx.IRGN = 0) table walks read memory: every
+ * write is therefore cleaned to the point of coherency before the TLB is
+ * invalidated.  Otherwise, since the data cache is physically tagged and the
+ * kernel reaches each frame via the identity map with the same attributes
+ * as the user window, the copy fork eventually makes needs no maintenance,
+ * and nor does a context switch beyond invalidating the branch predictor.
+ */
+
+// translates everything via TTBR1, and the bottom 1GB via TTBR0 until the
+// first process runs (its window entry is a translation fault)
+uint32_t vm_l1[ 4096 ] __attribute__ (( aligned( 16384 ) ));
+
+// frames are pages of the kernel heap: the one with page index i is mapped
+// by vm_ref[ i ] page table entries
+uint16_t vm_ref[ KHEAP_NPAGES ];
+
+// second-level tables, which are smaller than a page, and address spaces
+kcache_t vm_pt_cache;
+kcache_t vm_cache;
+
+// the address space TTBR0 and CONTEXTIDR currently point at
+vm_t*    vm_active = NULL;
+
+// the address space whose entries the TLB may hold for each ASID: ASIDs are
+// shared iff. MAX_PROCS > VM_ASIDS, in which case switching to an address
+// space whose ASID was last used by another has to flush it first
+vm_t*    vm_asid_owner[ VM_ASIDS + 1 ];
+
+static uint8_t* frame_alloc() {
+  uint8_t* x = kpage_alloc();
+
+  if( x != NULL ) {
+    vm_ref[ kpage_index( x ) ] = 1;
+  }
+
+  return x;
+}
+
+static void frame_release( uint8_t* x ) {
+  if( --vm_ref[ kpage_index( x ) ] == 0 ) {
+    kpage_free( x );
+  }
+}
+
+void vm_init() {
+  kcache_init( &vm_pt_cache, "pt", VM_PT_SIZE * sizeof( uint32_t ) );
+  kcache_init( &vm_cache,    "vm", sizeof( vm_t ) );
+
+  for( uint32_t i = 0; i < 4096; i++ ) {
+    if( i >= 0x100 && i < 0x200 ) { // 0x1000xxxx: peripherals, GIC
+      vm_l1[ i ] = ( i << 20 ) | L1_DEVICE;
+    }
+    else if( i == 0x000 || ( i >= 0x700 && i < 0x900 ) ) { // vectors; 512MB of RAM, inc. the image
+      vm_l1[ i ] = ( i << 20 ) | L1_CACHED;
+    }
+    else {
+      vm_l1[ i ] = ( i << 20 ) | L1_MEMORY;
+    }
+  }
+
+  vm_l1[ VM_USER_BASE >> 20 ] = 0; // translation fault until a process runs
+
+  for( int i = 0; i <= VM_ASIDS; i++ ) {
+    vm_asid_owner[ i ] = NULL;
+  }
+
+  mmu_set_dom( 0, 0x1 ); // client, i.e., check the access permissions
+  mmu_set_ttbcr( 2 );    // TTBR0 for [ 0x00000000, 0x40000000 ), TTBR1 otherwise
+  mmu_set_ptr0( vm_l1 );
+  mmu_set_ptr1( vm_l1 );
+  mmu_set_asid( 0 );
+  mmu_flush();
+  mmu_enable();
+
+  // anything left in the caches from before reset is stale, and must not be
+  // written back over memory, so invalidate rather than clean
+  mmu_cache_invalidate();
+  mmu_cache_enable();
+}
+
+vm_t* vm_create( int i ) {
+  vm_t*     x  = kcache_alloc( &vm_cache );
+  uint32_t* tt = kpage_alloc();
+  uint32_t* pt = kcache_alloc( &vm_pt_cache );
+
+  if( x == NULL || tt == NULL || pt == NULL ) {
+    if( x  != NULL ) {
+      kcache_free( &vm_cache, x );
+    }
+    if( tt != NULL ) {
+      kpage_free( tt );
+    }
+    if( pt != NULL ) {
+      kcache_free( &vm_pt_cache, pt );
+    }
+
+    return NULL;
+  }
+
+  x->tt    = tt;
+  x->pt    = pt;
+  x->asid  = ( i % VM_ASIDS ) + 1;
+  x->brk   = VM_USER_BASE + VM_HEAP_INIT;
+  x->users = 1;
+  x->refs  = 1;
+
+  kmem_copy_page( tt, vm_l1 ); // VM_TT_SIZE entries, i.e., one page
+  kmem_clear    ( pt, VM_PT_SIZE * sizeof( uint32_t ) );
+
+  tt[ VM_USER_BASE >> 20 ] = ( uint32_t )( pt ) | L1_COARSE;
+
+  mmu_clean( tt, VM_TT_SIZE * sizeof( uint32_t ) );
+  mmu_clean( pt, VM_PT_SIZE * sizeof( uint32_t ) );
+
+  return x;
+}
+
+void vm_attach( vm_t* x ) {
+  x->users++; x->refs++;
+}
+
+void vm_detach( vm_t* x ) {
+  if( --x->users == 0 ) {
+    vm_free( x );
+  }
+}
+
+void vm_destroy( vm_t* x ) {
+  if( --x->refs > 0 ) {
+    return;
+  }
+
+  // the slab may hand x out again, which must not look like either of these
+  if( vm_asid_owner[ x->asid ] == x ) {
+    vm_asid_owner[ x->asid ] = NULL;
+  }
+  if( vm_active == x ) {
+    vm_active = NULL;
+  }
+
+  kpage_free ( x->tt );
+  kcache_free( &vm_pt_cache, x->pt );
+  kcache_free( &vm_cache,    x     );
+}
+
+void vm_switch( vm_t* x ) {
+  if( vm_active == x ) {
+    return;
+  }
+
+  vm_active = x;
+
+  // switch via the reserved ASID, so no walk using the old TTBR0 is ever
+  // tagged with the new ASID (or vice versa)
+  mmu_set_asid( 0 );
+  mmu_set_ptr0( x->tt );
+
+  if( vm_asid_owner[ x->asid ] != x ) {
+    vm_asid_owner[ x->asid ]  = x;
+    mmu_flush_asid( x->asid );
+  }
+
+  mmu_set_asid( x->asid );
+  mmu_flush_bp();
+}
+
+bool vm_stack( vm_t* x, uint32_t n ) {
+  for( int i = VM_PT_SIZE - 1; n > 0; i-- ) {
+    uint8_t* f = ( i >= 0 ) ? frame_alloc() : NULL;
+
+    if( f == NULL ) {
+      vm_free( x ); return false;
+    }
+
+    // the entry was invalid, and the TLB never holds those: no flush needed
+    x->pt[ i ] = ( uint32_t )( f ) | L2_PAGE | L2_RW;
+
+    n = ( n > VM_PAGE_SIZE ) ? n - VM_PAGE_SIZE : 0;
+  }
+
+  mmu_clean( x->pt, VM_PT_SIZE * sizeof( uint32_t ) );
+
+  return true;
+}
+
+void vm_share( vm_t* dst, vm_t* src ) {
+  for( int i = 0; i < VM_PT_SIZE; i++ ) {
+    if( src->pt[ i ] != 0 ) {
+      src->pt[ i ] = ( src->pt[ i ] & ~L2_AP ) | L2_RO;
+      dst->pt[ i ] = src->pt[ i ];
+
+      vm_ref[ kpage_index( L2_FRAME( src->pt[ i ] ) ) ]++;
+    }
+  }
+
+  dst->brk = src->brk;
+
+  mmu_clean( src->pt, VM_PT_SIZE * sizeof( uint32_t ) );
+  mmu_clean( dst->pt, VM_PT_SIZE * sizeof( uint32_t ) );
+
+  mmu_flush_asid( src->asid ); // some entries of src were writable
+}
+
+void vm_free( vm_t* x ) {
+  for( int i = 0; i < VM_PT_SIZE; i++ ) {
+    if( x->pt[ i ] != 0 ) {
+      frame_release( L2_FRAME( x->pt[ i ] ) ); x->pt[ i ] = 0;
+    }
+  }
+
+  mmu_clean( x->pt, VM_PT_SIZE * sizeof( uint32_t ) );
+
+  mmu_flush_asid( x->asid );
+
+  x->brk = VM_USER_BASE + VM_HEAP_INIT;
+}
+
+bool vm_brk( vm_t* x, uint32_t y ) {
+  if( y < VM_USER_BASE + VM_HEAP_INIT || y > VM_USER_TOP ) {
+    return false;
+  }
+
+  // the heap covers pages [ 0, lo ) now, and will cover [ 0, hi )
+  int lo = ( x->brk - VM_USER_BASE + VM_PAGE_SIZE - 1 ) / VM_PAGE_SIZE;
+  int hi = ( y       - VM_USER_BASE + VM_PAGE_SIZE - 1 ) / VM_PAGE_SIZE;
+
+  // pages beyond the heap are never mapped unless they are stack
+  for( int i = lo; i < hi; i++ ) {
+    if( x->pt[ i ] != 0 ) {
+      return false;
+    }
+  }
+
+  for( int i = hi; i < lo; i++ ) {
+    if( x->pt[ i ] != 0 ) {
+      frame_release( L2_FRAME( x->pt[ i ] ) ); x->pt[ i ] = 0;
+
+      mmu_clean( &x->pt[ i ], sizeof( uint32_t ) );
+      mmu_flush_page( ( VM_USER_BASE + i * VM_PAGE_SIZE ) | x->asid );
+    }
+  }
+
+  x->brk = y;
+
+  return true;
+}
+
+bool vm_fault( vm_t* x, uint32_t y ) {
+  if( y < VM_USER_BASE || y >= VM_USER_TOP ) {
+    return false;
+  }
+
+  uint32_t* e = &x->pt[ ( y - VM_USER_BASE ) / VM_PAGE_SIZE ];
+
+  if( *e == 0 || ( *e & L2_AP ) != L2_RO ) {
+    return false;
+  }
+
+  uint8_t* f = L2_FRAME( *e );
+
+  // the last process sharing a frame can just take it over; the others each
+  // get a private copy
+  if( vm_ref[ kpage_index( f ) ] > 1 ) {
+    uint8_t* g = frame_alloc();
+
+    if( g == NULL ) {
+      return false;
+    }
+
+    kmem_copy_page( g, f ); frame_release( f ); f = g;
+  }
+
+  *e = ( uint32_t )( f ) | L2_PAGE | L2_RW;
+
+  mmu_clean( e, sizeof( uint32_t ) );
+  mmu_flush_page( ( y & ~( VM_PAGE_SIZE - 1 ) ) | x->asid );
+
+  return true;
+}
+
+bool vm_demand( vm_t* x, uint32_t y ) {
+  if( y < VM_USER_BASE || y >= x->brk ) {
+    return false;
+  }
+
+  uint32_t* e = &x->pt[ ( y - VM_USER_BASE ) / VM_PAGE_SIZE ];
+
+  if( *e != 0 ) {
+    return false;
+  }
+
+  uint8_t* f = frame_alloc();
+
+  if( f == NULL ) {
+    return false;
+  }
+
+  kmem_clear( f, VM_PAGE_SIZE );
+
+  // the entry was invalid, and the TLB never holds those: no flush needed
+  *e = ( uint32_t )( f ) | L2_PAGE | L2_RW;
+
+  mmu_clean( e, sizeof( uint32_t ) );
+
+  return true;
+}
+
+bool vm_touch( vm_t* x, uint32_t y, uint32_t n, bool w ) {
+  // only the part of [ y, y + n ) within the user window matters
+  uint32_t lo = ( y     > VM_USER_BASE          ) ? y     : VM_USER_BASE;
+  uint32_t hi = ( y + n < y || y + n > VM_USER_TOP ) ? VM_USER_TOP : y + n;
+
+  for( uint32_t z = lo & ~( VM_PAGE_SIZE - 1 ); z < hi; z += VM_PAGE_SIZE ) {
+    uint32_t* e = &x->pt[ ( z - VM_USER_BASE ) / VM_PAGE_SIZE ];
+
+    if( *e == 0 && !vm_demand( x, z ) ) {
+      return false;
+    }
+    if( w && ( *e & L2_AP ) == L2_RO && !vm_fault( x, z ) ) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void* vm_frame( vm_t* x, uint32_t y ) {
+  if( y < VM_USER_BASE || y >= VM_USER_TOP ) {
+    return NULL;
+  }
+
+  uint32_t e = x->pt[ ( y - VM_USER_BASE ) / VM_PAGE_SIZE ];
+
+  if( e == 0 ) {
+    return NULL;
+  }
+
+  return L2_FRAME( e ) + ( y & ( VM_PAGE_SIZE - 1 ) );
+}
@@ -0,0 +1,119 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __VM_H
+#define __VM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string.h>
+
+#include   "MMU.h"
+#include  "kmem.h"
+#include "kheap.h"
+
+/* The MMU maps the whole address space 1:1 using 1MB sections (so the kernel,
+ * the devices, and the text and data of user programs look exactly as they
+ * did with it disabled), except for one 1MB window at VM_USER_BASE.  Within
+ * that window each process has its own second-level page table, so each sees
+ * its own stack at the same virtual addresses, topping out at VM_USER_TOP.
+ *
+ * TTBCR.N = 2 splits the address space: the bottom 1GB (which holds the
+ * vectors, the devices and the user window) is translated via TTBR0 using a
+ * first-level table per process, and the rest (which holds the kernel image)
+ * via TTBR1 using a single table shared by everything.  The user window is
+ * mapped non-global, tagged with the ASID of the process in CONTEXTIDR, so a
+ * context switch just changes TTBR0 and the ASID; the TLB is not flushed.
+ *
+ * The bottom of the window is the heap, i.e., [ VM_USER_BASE, brk ), whose
+ * end a process moves via SYS_BRK.  A heap page is only allocated (and
+ * zeroed) once it is first touched, so growing the heap costs nothing up
+ * front.  The heap starts VM_HEAP_INIT bytes long: so a process can always
+ * use its first page, which is where the C library keeps the malloc state of
+ * each process (its globals being shared by every process).
+ *
+ * Threads (see SYS_THREAD_CREATE) share an address space, so each vm_t is
+ * allocated on its own and counted: its pages are unmapped once the last
+ * thread using it terminates, but its tables only once no PCB points at it.
+ *
+ * Stack pages are backed by frames, and page tables stored in memory, taken
+ * from the kernel heap (see kheap.h).  fork shares the parent's frames with the child
+ * read-only rather than copying them, and a frame is only copied once either
+ * process writes to it (i.e., it takes a permission fault on it), or once
+ * the kernel is about to write to it on the process' behalf (see vm_touch).
+ */
+
+#define VM_PAGE_SIZE  0x00001000
+#define VM_PT_SIZE    256         // entries in a second-level page table
+#define VM_TT_SIZE    1024        // entries in a first-level table for TTBR0 (i.e., for N = 2)
+
+#define VM_USER_BASE  0x20000000
+#define VM_USER_TOP   ( VM_USER_BASE + ( VM_PT_SIZE * VM_PAGE_SIZE ) )
+
+#define VM_HEAP_INIT  VM_PAGE_SIZE
+
+// the address space of a process
+typedef struct {
+  uint32_t* tt;   // first-level  table (VM_TT_SIZE entries, i.e., one page)
+  uint32_t* pt;   // second-level table (VM_PT_SIZE entries, 1KB aligned) for the user window
+  uint32_t  asid; // 1 to 255; ASID 0 is reserved for switching
+  uint32_t  brk;  // end of the heap
+
+  uint32_t  users; // live processes (i.e., threads) using it, see vm_detach
+  uint32_t  refs;  // PCBs pointing at it, live or not, see vm_destroy
+} vm_t;
+
+// build the identity map, then enable the MMU
+extern void vm_init();
+// allocate an address space with fresh tables, and an ASID derived from i
+// (e.g., the PID of the process), used by one process; NULL if there is not
+// enough memory for it
+extern vm_t* vm_create ( int i );
+// add a process (i.e., a thread) to those using x
+extern void  vm_attach ( vm_t* x );
+// remove a terminated process from those using x, unmapping every page via
+// vm_free iff. it was the last
+extern void  vm_detach ( vm_t* x );
+// drop a PCB's reference to x, freeing x and its tables iff. it was the last
+// (by which time x must no longer be in use)
+extern void  vm_destroy( vm_t* x );
+
+// make the address space x (i.e., that of the next process) the one in use,
+// which costs nothing if it already is (e.g., x is shared by two threads)
+extern void vm_switch( vm_t* x );
+
+// map n bytes of fresh, writable stack below VM_USER_TOP; false if there are
+// not enough free frames
+extern bool vm_stack( vm_t* x, uint32_t n );
+// share every page mapped by src with dst, copy-on-write
+extern void vm_share( vm_t* dst, vm_t* src );
+// unmap every page mapped by x, freeing any frame no longer shared, and
+// reset its heap
+extern void vm_free ( vm_t* x );
+
+// move the end of the heap to y, unmapping any page it no longer covers;
+// false if the heap would run into the stack, or out of the window
+extern bool vm_brk( vm_t* x, uint32_t y );
+
+// resolve a permission fault taken by a write to y; false if y is not a
+// copy-on-write page (i.e., the fault is genuine)
+extern bool vm_fault( vm_t* x, uint32_t y );
+// resolve a translation fault taken by an access to y, by mapping a zeroed
+// page; false if y is not within the heap (i.e., the fault is genuine)
+extern bool vm_demand( vm_t* x, uint32_t y );
+// make [ y, y + n ) present, plus writable iff. w, ahead of the kernel
+// accessing it; false if any of it lies within the user window but is
+// neither mapped nor part of the heap
+extern bool vm_touch( vm_t* x, uint32_t y, uint32_t n, bool w );
+// the address the kernel can reach y through (i.e., via the identity map of
+// the frame it is mapped to) in x, which need not be the address space in
+// use; NULL if y is not mapped
+extern void* vm_frame( vm_t* x, uint32_t y );
+
+#endif
@@ -0,0 +1,131 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "BC.h"
+
+/* An exercise for the kernel's block cache, via bread, bwrite, sync and
+ * bstat.  It writes a pattern to the first BC_BLOCKS blocks of the disk
+ * (overwriting whatever was there), which is more than the cache holds, so
+ * some are evicted and so written back; syncs the rest; reads them all back
+ * and checks the pattern; then dirties one block and waits for the kernel to flush
+ * it (which it should do within BC_FLUSH_MS).  Each step reports what it saw
+ * plus how the counters of the cache moved, so, e.g., a write back that
+ * never happens shows up as blocks still dirty.
+ *
+ * Given the argument stream (plus, optionally, a number of blocks n), it
+ * instead just reads the first n (BC_STREAM by default) blocks in order, as
+ * one sequential stream, so the misses and readaheads it reports show how
+ * much of it the cache read ahead.  The disk is left as it was.
+ */
+
+#define BC_BLOCKS   ( 96     )
+#define BC_STREAM   ( 1000   )
+#define BC_FLUSH_MS ( 5000   ) // i.e., BCACHE_FLUSH_MS in the kernel
+#define BC_LEN_MAX  ( 0x1000 ) // the longest block the cache takes
+
+uint8_t bc_x[ BC_LEN_MAX ];
+
+static void bc_puts( char* x ) {
+  write( STDOUT_FILENO, x, strlen( x ) );
+}
+
+static void bc_putn( uint32_t x ) {
+  char t[ 12 ]; itoa( t, x ); bc_puts( t );
+}
+
+static uint8_t bc_byte( uint32_t a, int i ) {
+  return ( a * 31 + i ) & 0xFF;
+}
+
+// report step s: n things went wrong, then how the cache moved from *x on,
+// after which *x is up to date
+static void bc_report( char* s, int n, bcachestat_t* x ) {
+  bcachestat_t y; bstat( &y );
+
+  bc_puts( "BC: "             ); bc_puts( s );
+  bc_puts( ": "               ); bc_putn( n );
+  bc_puts( " failed, hits "   ); bc_putn( y.hits       - x->hits       );
+  bc_puts( ", misses "        ); bc_putn( y.misses     - x->misses     );
+  bc_puts( ", readaheads "    ); bc_putn( y.readaheads - x->readaheads );
+  bc_puts( ", writebacks "    ); bc_putn( y.writebacks - x->writebacks );
+  bc_puts( ", dirty "         ); bc_putn( y.dirty                      );
+  bc_puts( "\n"               );
+
+  *x = y;
+}
+
+static void bc_stream( bcachestat_t* x, uint32_t m ) {
+  int n = 0;
+
+  for( uint32_t a = 0; a < m; a++ ) {
+    n += ( bread( a, bc_x ) < 0 );
+  }
+
+  bc_report( "stream", n, x );
+}
+
+static void bc_check( bcachestat_t* x ) {
+  int n = 0;
+
+  for( uint32_t a = 0; a < BC_BLOCKS; a++ ) {
+    for( int i = 0; i < x->len; i++ ) {
+      bc_x[ i ] = bc_byte( a, i );
+    }
+
+    n += ( bwrite( a, bc_x ) < 0 );
+  }
+
+  bc_report( "write", n, x );
+
+  bc_report( "sync", ( sync() < 0 ), x );
+
+  n = 0;
+
+  for( uint32_t a = 0; a < BC_BLOCKS; a++ ) {
+    memset( bc_x, 0, x->len );
+
+    if( bread( a, bc_x ) < 0 ) {
+      n++; continue;
+    }
+
+    for( int i = 0; i < x->len; i++ ) {
+      if( bc_x[ i ] != bc_byte( a, i ) ) {
+        n++; break;
+      }
+    }
+  }
+
+  bc_report( "read back", n, x );
+
+  // dirty one block again, then leave it to the kernel to write back
+  bwrite( 0, bc_x ); sleep( 2 * BC_FLUSH_MS );
+
+  bcachestat_t y; bstat( &y );
+
+  bc_report( "timed flush", y.dirty, x );
+}
+
+void main_BC( int argc, char* argv[] ) {
+  bool         stream = ( argc > 1 ) && ( 0 == strcmp( argv[ 1 ], "stream" ) );
+  uint32_t     m      = ( argc > 2 ) ? atoi( argv[ 2 ] ) : BC_STREAM;
+  bcachestat_t x;
+
+  // the first read sets the cache up, so only then is the block length known
+  if( bread( 0, bc_x ) < 0 || bstat( &x ) < 0 || x.num < ( stream ? m : BC_BLOCKS ) ) {
+    bc_puts( "BC: no disk, or too small a one\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  if( stream ) {
+    bc_stream( &x, m );
+  }
+  else {
+    bc_check( &x );
+  }
+
+  exit( EXIT_SUCCESS );
+}
@@ -23,7 +23,9 @@
 
   main_DP()
 
-    1. Create philosophers. i is equal to id for philosophers.
+    1. Create philosophers, each a thread (so they share forks[] and lock, and
+       are cheap to create and switch between) on a DP_STACK byte stack.
+       i is equal to id for philosophers.
         ex) i == 0 -> 0-th philosopher
 
     2. Lock 'picking up forks' process by sem_wait()          2 ~ 3 is critical section
@@ -36,64 +38,84 @@
 */
 #include "DP.h"
 
-// make 16 Fork for 16 philosopher child processes.
+// how long (in milliseconds) a philosopher spends thinking, and eating
+#define DP_THINK_MS ( 1000 )
+#define DP_EAT_MS   ( 1000 )
+
+// bytes of stack each philosopher thread gets
+#define DP_STACK    ( 0x400 )
+
+// make 16 Fork for 16 philosopher threads.
 int forks[16] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
 int lock = 1;
 int choose_fork(int index, char c);
+void philosopher_main(void* x);
 
 void main_DP() {
   write( STDOUT_FILENO, "main_DP() is now running", 24 );
 
+  uint8_t* stacks = malloc( 16 * DP_STACK );
+
+  if (stacks == NULL) {
+    exit( EXIT_FAILURE );
+  }
+
   for (int i = 0; i < 16; i++) {
-    if (fork() == 0) {
-      char philosopher[2] = { i / 10 + '0', i % 10 + '0' };
-      while (1) {
+    thread_create( &philosopher_main, ( void* )( i ), stacks + ( i + 1 ) * DP_STACK );
+  }
 
-        sleep();
+  // the philosophers carry on once this thread exits, as does the heap
+  // their stacks are on
+  exit( EXIT_SUCCESS );
+}
 
-        write( STDOUT_FILENO, philosopher, 2 );
-        write( STDOUT_FILENO, " is thinking\n", 13 );
+void philosopher_main(void* x) {
+  int i = ( int )( x );
+  char philosopher[2] = { i / 10 + '0', i % 10 + '0' };
+  while (1) {
 
-        sem_wait(&lock);
+    sleep( DP_THINK_MS );
 
-        int left = choose_fork(i, 'l');
-        int right = choose_fork(i, 'r');
-        if (forks[left] == 1 && forks[right] == 1) {
-          sem_wait(&forks[left]);
-          sem_wait(&forks[right]);
-          sem_post(&lock);
+    write( STDOUT_FILENO, philosopher, 2 );
+    write( STDOUT_FILENO, " is thinking\n", 13 );
 
-          write( STDOUT_FILENO, philosopher, 2 );
-          write( STDOUT_FILENO, " PICKS UP both forks\n", 21 );
+    sem_wait(&lock);
 
-        } else {
-          sem_post(&lock);
+    int left = choose_fork(i, 'l');
+    int right = choose_fork(i, 'r');
+    if (forks[left] == 1 && forks[right] == 1) {
+      sem_wait(&forks[left]);
+      sem_wait(&forks[right]);
+      sem_post(&lock);
 
-          write( STDOUT_FILENO, philosopher, 2 );
-          write( STDOUT_FILENO, " FAILS PICKING UP both forks\n", 29 );
+      write( STDOUT_FILENO, philosopher, 2 );
+      write( STDOUT_FILENO, " PICKS UP both forks\n", 21 );
 
-          continue;
-        }
+    } else {
+      sem_post(&lock);
 
-        write( STDOUT_FILENO, philosopher, 2);
-        write( STDOUT_FILENO, " is eating\n", 11 );
+      write( STDOUT_FILENO, philosopher, 2 );
+      write( STDOUT_FILENO, " FAILS PICKING UP both forks\n", 29 );
 
-        sleep();
+      continue;
+    }
 
-        write( STDOUT_FILENO, philosopher, 2 );
-        write( STDOUT_FILENO, " finishes eating\n", 17 );
+    write( STDOUT_FILENO, philosopher, 2);
+    write( STDOUT_FILENO, " is eating\n", 11 );
 
-        sem_wait(&lock);
-        sem_post(&forks[left]);
-        sem_post(&forks[right]);
-        sem_post(&lock);
+    sleep( DP_EAT_MS );
 
-        write( STDOUT_FILENO, philosopher, 2 );
-        write( STDOUT_FILENO, " puts down forks\n", 17 );
-      }
-    }
+    write( STDOUT_FILENO, philosopher, 2 );
+    write( STDOUT_FILENO, " finishes eating\n", 17 );
+
+    sem_wait(&lock);
+    sem_post(&forks[left]);
+    sem_post(&forks[right]);
+    sem_post(&lock);
+
+    write( STDOUT_FILENO, philosopher, 2 );
+    write( STDOUT_FILENO, " puts down forks\n", 17 );
   }
-  exit( EXIT_SUCCESS );
 }
 
 /******************************************************************************/
@@ -0,0 +1,125 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "MB.h"
+
+/* A microbenchmark for the kernel's copy and clear routines (see kmem.h).
+ * Those only run in SVC mode, so it cannot call them: instead, each case
+ * makes the kernel use one, MB_ITERS times over, via system calls and page
+ * faults, and reports the processor time (as per ps) that took next to that
+ * libc took to do the same copy or clear of a page in USR mode.
+ *
+ * - demand page: grow the heap by a page then touch it, so the kernel clears
+ *   a fresh frame (kmem_clear), then shrink it back again;
+ * - fork + cow: fork (kmem_copy_ctx, plus kmem_copy_page for the first-level
+ *   table), then write to a page shared with the child, so the kernel copies
+ *   it (kmem_copy_page); the child exits at once.
+ *
+ * So the kernel numbers include the cost of the system calls, faults and
+ * (for fork) the rest of creating a process, and are an upper bound on what
+ * the routines themselves cost.
+ */
+
+#define MB_ITERS ( 1024   )
+#define MB_PAGE  ( 0x1000 )
+
+uint8_t mb_x[ MB_PAGE ] __attribute__ (( aligned( 64 ) ));
+uint8_t mb_y[ MB_PAGE ] __attribute__ (( aligned( 64 ) ));
+
+// a page of the heap, just below the break
+uint8_t* mb_p = NULL;
+
+typedef void ( *mb_fn_t )();
+
+static void mb_libc_copy() {
+  memcpy( mb_x, mb_y, MB_PAGE );
+}
+static void mb_libc_clear() {
+  memset( mb_x, 0, MB_PAGE );
+}
+static void mb_demand() {
+  brk( mb_p + MB_PAGE ); mb_p[ 0 ] = 1; brk( mb_p );
+}
+static void mb_fork() {
+  pid_t pid = fork();
+
+  if( pid == 0 ) {
+    exit( EXIT_SUCCESS );
+  }
+
+  mb_p[ 0 ]++;
+
+  // let the child exit, so its frames and PID are free again
+  yield();
+}
+
+typedef struct {
+  char*   name;
+  mb_fn_t libc;
+  mb_fn_t kmem;
+} mb_case_t;
+
+mb_case_t mb_cases[] = {
+  { "demand page", mb_libc_clear, mb_demand },
+  { "fork + cow ", mb_libc_copy,  mb_fork   }
+};
+
+// processor time used by the caller so far, in milliseconds: the caller is
+// the only process ps can find executing
+static uint32_t mb_cpu_time() {
+  procstat_t x;
+
+  for( int i = 0; ( i = ps( i, &x ) ) >= 0; ) {
+    if( x.status == PROC_EXECUTING ) {
+      return x.cpu_time;
+    }
+  }
+
+  return 0;
+}
+
+static uint32_t mb_time( mb_fn_t f ) {
+  uint32_t t = mb_cpu_time();
+
+  for( int i = MB_ITERS; i > 0; i-- ) {
+    f();
+  }
+
+  return mb_cpu_time() - t;
+}
+
+static void mb_putn( uint32_t x ) {
+  char t[ 12 ]; itoa( t, x ); write( STDOUT_FILENO, t, strlen( t ) );
+}
+
+void main_MB() {
+  // start the heap on a page boundary, so mb_p is a whole page
+  mb_p = ( uint8_t* )( ( ( uint32_t )( brk( NULL ) ) + MB_PAGE - 1 ) & ~( MB_PAGE - 1 ) );
+
+  if( brk( mb_p ) == ( void* )( -1 ) ) {
+    exit( EXIT_FAILURE );
+  }
+
+  for( int i = 0; i < sizeof( mb_cases ) / sizeof( mb_case_t ); i++ ) {
+    mb_case_t* c = &mb_cases[ i ];
+
+    // fork + cow needs the page mapped, so that the child shares it
+    if( c->kmem == mb_fork ) {
+      brk( mb_p + MB_PAGE ); mb_p[ 0 ] = 1;
+    }
+
+    uint32_t libc = mb_time( c->libc );
+    uint32_t kmem = mb_time( c->kmem );
+
+    write( STDOUT_FILENO, c->name, strlen( c->name ) );
+    write( STDOUT_FILENO, " : libc ", 8 ); mb_putn( libc );
+    write( STDOUT_FILENO, " ms, kernel ", 12 ); mb_putn( kmem );
+    write( STDOUT_FILENO, " ms\n", 4 );
+  }
+
+  exit( EXIT_SUCCESS );
+}
@@ -8,18 +8,210 @@
 #include "console.h"
 
 void puts( char* x, int n ) {
-  for( int i = 0; i < n; i++ ) {
-    PL011_putc( UART1, x[ i ], true );
-  }
+  write( CONSOLE_FILENO, x, n );
 }
 
+// read blocks until a whole line has arrived, so the console costs nothing
+// while it waits for a command
 void gets( char* x, int n ) {
-  for( int i = 0; i < n; i++ ) {
-    x[ i ] = PL011_getc( UART1, true );
+  int i = 0;
+
+  while( i < ( n - 1 ) ) {
+    i += read( CONSOLE_FILENO, &x[ i ], ( n - 1 ) - i );
+
+    if( x[ i - 1 ] == '\x0A' ) {
+      i--; break;
+    }
+  }
+
+  x[ i ] = '\x00';
+}
+
+// write integer x, right-aligned within (at least) w characters
+void putn( int x, int w ) {
+  char t[ 12 ]; itoa( t, x ); int n = strlen( t );
+
+  for( int i = n; i < w; i++ ) {
+    puts( " ", 1 );
+  }
+
+  puts( t, n );
+}
+
+// the 3-character ST column of ps and top for status x
+char* status_name( int x ) {
+  switch( x ) {
+    case PROC_CREATED   : return "  C";
+    case PROC_READY     : return "  R";
+    case PROC_EXECUTING : return "  E";
+    case PROC_WAITING   : return "  W";
+    default             : return "  ?";
+  }
+}
+
+char* syscall_name[ NSYSCALLS ] = {
+  "yield", "write", "read", "fork", "exit", "exec", "kill", "nice",
+  "sleep", "futex_wait", "futex_wake", "ps", "slab", "brk",
+  "spawn", "thread_create", "thread_join", "sync", "bread", "bwrite",
+  "bstat"
+};
+
+// list every process, or the system calls made by process pid iff. pid >= -1
+void ps_list( int pid ) {
+  procstat_t x;
+
+  if( pid < -1 ) {
+    puts( "  PID TGID ST PRI   CPU(ms)  WAIT(ms)   VCSW  IVCSW  SYSCALLS\n", 62 );
+  }
+
+  for( int i = 0; ( i = ps( i, &x ) ) >= 0; ) {
+    int n = 0;
+
+    for( int j = 0; j < NSYSCALLS; j++ ) {
+      n += x.syscalls[ j ];
+    }
+
+    if( pid < -1 ) {
+      putn( x.pid, 5 ); putn( x.tgid, 5 ); puts( status_name( x.status ), 3 );
+      putn( x.base_priority,  4 );
+      putn( x.cpu_time,      10 );
+      putn( x.wait_time,     10 );
+      putn( x.nvcsw,          7 );
+      putn( x.nivcsw,         7 );
+      putn( n,               10 );
+      puts( "\n", 1 );
+    }
+    else if( pid == x.pid ) {
+      for( int j = 0; j < NSYSCALLS; j++ ) {
+        if( x.syscalls[ j ] != 0 ) {
+          char* t = syscall_name[ j ];
 
-    if( x[ i ] == '\x0A' ) {
-      x[ i ] = '\x00'; break;
+          if( t != NULL ) {
+            puts( t, strlen( t ) );
+          }
+          else {
+            putn( j, 0 );
+          }
+
+          puts( " : ", 3 ); putn( x.syscalls[ j ], 0 ); puts( "\n", 1 );
+        }
+      }
+
+      return;
+    }
+  }
+}
+
+// list every cache of the kernel heap, and what it holds
+void slab_list() {
+  slabstat_t x;
+
+  puts( "NAME              SIZE  SLABS   USED  AVAIL     ALLOCS  FAILS\n", 62 );
+
+  for( int i = 0; ( i = slab( i, &x ) ) >= 0; ) {
+    int n = strlen( x.name );
+
+    puts( x.name, n );
+
+    for( int j = n; j < 14; j++ ) {
+      puts( " ", 1 );
     }
+
+    putn( x.size,    8 );
+    putn( x.slabs,   7 );
+    putn( x.used,    7 );
+    putn( x.avail,   7 );
+    putn( x.allocs, 11 );
+    putn( x.fails,   7 );
+    puts( "\n", 1 );
+  }
+}
+
+// list the statistics of the block cache
+void bcache_list() {
+  bcachestat_t x;
+
+  if( bstat( &x ) < 0 ) {
+    puts( "no block cache\n", 15 );
+    return;
+  }
+
+  puts( "  BLOCKS  LEN  BUFS  USED DIRTY       HITS     MISSES WRITEBACKS READAHEADS\n", 76 );
+
+  putn( x.num,         8 );
+  putn( x.len,         5 );
+  putn( x.bufs,        6 );
+  putn( x.used,        6 );
+  putn( x.dirty,       6 );
+  putn( x.hits,       11 );
+  putn( x.misses,     11 );
+  putn( x.writebacks, 11 );
+  putn( x.readaheads, 11 );
+  puts( "\n", 1 );
+}
+
+typedef struct {
+  pid_t    pid;
+  int      status;
+  uint32_t cpu_time;
+  uint32_t delta;
+} top_t;
+
+// snapshot (up to TOP_MAX) processes into x, computing how much processor
+// time each used since snapshot y (of m processes); return the number taken
+int top_sample( top_t* x, top_t* y, int m ) {
+  procstat_t t; int n = 0;
+
+  for( int i = 0; n < TOP_MAX && ( i = ps( i, &t ) ) >= 0; n++ ) {
+    x[ n ].pid      = t.pid;
+    x[ n ].status   = t.status;
+    x[ n ].cpu_time = t.cpu_time;
+    x[ n ].delta    = t.cpu_time;
+
+    for( int j = 0; j < m; j++ ) {
+      if( y[ j ].pid == t.pid ) {
+        x[ n ].delta -= y[ j ].cpu_time; break;
+      }
+    }
+  }
+
+  return n;
+}
+
+// every TOP_PERIOD, k times over, list processes by processor time used
+void top( int k ) {
+  top_t x[ TOP_MAX ], y[ TOP_MAX ]; int m = top_sample( y, y, 0 );
+
+  while( k-- > 0 ) {
+    sleep( TOP_PERIOD );
+
+    int n = top_sample( x, y, m ); uint32_t total = 0;
+
+    for( int i = 0; i < n; i++ ) {
+      total += x[ i ].delta;
+    }
+
+    // sort by decreasing delta, keeping a copy for the next sample
+    for( int i = 0; i < n; i++ ) {
+      y[ i ] = x[ i ];
+
+      for( int j = i; j > 0 && x[ j ].delta > x[ j - 1 ].delta; j-- ) {
+        top_t t = x[ j ]; x[ j ] = x[ j - 1 ]; x[ j - 1 ] = t;
+      }
+    }
+
+    m = n;
+
+    puts( "  PID ST  %CPU   CPU(ms)\n", 25 );
+
+    for( int i = 0; i < n; i++ ) {
+      putn( x[ i ].pid, 5 ); puts( status_name( x[ i ].status ), 3 );
+      putn( ( total != 0 ) ? ( x[ i ].delta * 100 ) / total : 0, 6 );
+      putn( x[ i ].cpu_time, 10 );
+      puts( "\n", 1 );
+    }
+
+    puts( "\n", 1 );
   }
 }
 
@@ -27,9 +219,14 @@ extern void main_P3();
 extern void main_P4();
 extern void main_P5();
 extern void main_DP();
+extern void main_MB();
+extern void main_BC();
 
 void* load( char* x ) {
-  if     ( 0 == strcmp( x, "P3" ) ) {
+  if     ( x == NULL ) {
+    return NULL;
+  }
+  else if( 0 == strcmp( x, "P3" ) ) {
     return &main_P3;
   }
   else if( 0 == strcmp( x, "P4" ) ) {
@@ -41,6 +238,12 @@ void* load( char* x ) {
   else if( 0 == strcmp( x, "DP" ) ) {
     return &main_DP;
   }
+  else if( 0 == strcmp( x, "MB" ) ) {
+    return &main_MB;
+  }
+  else if( 0 == strcmp( x, "BC" ) ) {
+    return &main_BC;
+  }
 
   return NULL;
 }
@@ -54,16 +257,21 @@ void* load( char* x ) {
  *
  * As is, the console only recognises the following commands:
  *
- * a. execute <program name>
+ * a. execute <program name> [argument ...]
  *
- *    This command will use fork to create a new process; the parent
- *    (i.e., the console) will continue as normal, whereas the child
- *    uses exec to replace the process image and thereby execute a
- *    different (named) program.  For example,
+ *    This command will use spawn to create a new process, which starts
+ *    executing a different (named) program on a fresh stack, while the
+ *    console continues as normal.  The program is passed its name plus
+ *    any arguments, as argc and argv.  For example,
  *
  *    execute P3
  *
- *    would execute the user program named P3.
+ *    would execute the user program named P3.  MB is a microbenchmark
+ *    for the kernel's copy and clear routines (via the system calls that
+ *    use them), and BC exercises the block
+ *    cache (overwriting the start of the disk), reporting what it checked
+ *    and how the cache statistics moved; "execute BC stream 1000" instead
+ *    reads blocks 0 to 999 in order, to show how much was read ahead.
  *
  * b. terminate <process ID>
  *
@@ -76,7 +284,30 @@ void* load( char* x ) {
  *
  *    would terminate the process whose PID is 3.
  *
- * c. nice(<process ID>, <base_priority>)
+ * c. ps [process ID]
+ *
+ *    This command uses ps to list every process along with the kernel's
+ *    accounting for it: the processor time it has used, the time it has
+ *    spent blocked, how often it gave up the processor (VCSW) or was
+ *    preempted (IVCSW), and how many system calls it made.  Given a PID,
+ *    it instead breaks the system calls made by that process down by
+ *    identifier.  PID -1 is the idle process.
+ *
+ * d. top [count]
+ *
+ *    This command lists processes by the share of processor time each
+ *    used over the last TOP_PERIOD milliseconds, count (5 by default)
+ *    times over; it is a quick way to find out which process hogs the
+ *    processor.
+ *
+ * e. slab
+ *
+ *    This command lists the caches of the kernel heap: for each, the size
+ *    of its objects, how many pages (slabs) it holds, how many objects are
+ *    in use or free, and how many allocations succeeded or failed.  The
+ *    first line is the page allocator, which the caches take slabs from.
+ *
+ * f. nice(<process ID>, <base_priority>)
  *
  *    This command uses nice to set base_priority. This forces to change
  *    procTab[i].base_priority therefore priority of procTab[i] could be
@@ -119,6 +350,19 @@ void* load( char* x ) {
         [1->0]
 
         [TIMER]
+
+ * g. bcache
+ *
+ *    This command lists the statistics of the kernel's block cache: the
+ *    geometry of the disk, how many blocks the cache holds (and of them,
+ *    how many are dirty, i.e., yet to be written back), how many reads
+ *    or writes hit or missed it, and how many blocks were read ahead.
+ *    The disk geometry reads as 0 until a process first uses the cache.
+ *
+ * h. sync
+ *
+ *    This command uses sync to write every dirty block in the cache back
+ *    to the disk at once, rather than wait for the kernel to do so.
  */
 
 void main_console() {
@@ -131,20 +375,26 @@ void main_console() {
 
     // step 2: tokenize command.
 
-    int cmd_argc = 0; char* cmd_argv[ MAX_CMD_ARGS ];
+    int cmd_argc = 0; char* cmd_argv[ MAX_CMD_ARGS + 1 ];
 
-    for( char* t = strtok( cmd, " " ); t != NULL; t = strtok( NULL, " " ) ) {
+    for( char* t = strtok( cmd, " " ); t != NULL && cmd_argc < MAX_CMD_ARGS; t = strtok( NULL, " " ) ) {
       cmd_argv[ cmd_argc++ ] = t;
     }
 
+    cmd_argv[ cmd_argc ] = NULL;
+
+    if( cmd_argc == 0 ) {
+      continue;
+    }
+
     // step 3: execute command.
 
     if     ( 0 == strcmp( cmd_argv[ 0 ], "execute"   ) ) {
       void* addr = load( cmd_argv[ 1 ] );
 
       if( addr != NULL ) {
-        if( 0 == fork() ) {
-          exec( addr );
+        if( -1 == spawn( addr, 1, &cmd_argv[ 1 ] ) ) {
+          puts( "cannot execute\n", 15 );
         }
       }
       else {
@@ -156,6 +406,28 @@ void main_console() {
       kill( atoi( cmd_argv[ 1 ] ), SIG_TERM );
     }
 
+    else if ( 0 == strcmp( cmd_argv[ 0 ], "ps"        ) ) {
+      ps_list( ( cmd_argc > 1 ) ? atoi( cmd_argv[ 1 ] ) : -2 );
+    }
+
+    else if ( 0 == strcmp( cmd_argv[ 0 ], "top"       ) ) {
+      top( ( cmd_argc > 1 ) ? atoi( cmd_argv[ 1 ] ) :  5 );
+    }
+
+    else if ( 0 == strcmp( cmd_argv[ 0 ], "slab"      ) ) {
+      slab_list();
+    }
+
+    else if ( 0 == strcmp( cmd_argv[ 0 ], "bcache"    ) ) {
+      bcache_list();
+    }
+
+    else if ( 0 == strcmp( cmd_argv[ 0 ], "sync"      ) ) {
+      if( sync() < 0 ) {
+        puts( "cannot sync\n", 12 );
+      }
+    }
+
     else if (0 == strcmp( cmd_argv[ 0 ], "nice" )){
         int pid = atoi(strtok( NULL, " " ));
         int priority = atoi(strtok( NULL, " " ));
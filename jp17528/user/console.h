@@ -14,11 +14,12 @@
 
 #include <string.h>
 
-#include "PL011.h"
-
 #include "libc.h"
 
 #define MAX_CMD_CHARS ( 1024 )
-#define MAX_CMD_ARGS  (    2 )
+#define MAX_CMD_ARGS  (    8 )
+
+#define TOP_MAX       (   32 ) // processes top keeps track of
+#define TOP_PERIOD    ( 1000 ) // milliseconds between each top update
 
 #endif
@@ -7,13 +7,7 @@
 
 #include "libc.h"
 
-// each processor gets virtual memory allocated from 0x0000000 to 0xFFFFFFF
-// asm volatile("nop") makes no semantic difference. Force the compiler to not collapse the code paths 
-void sleep() {
-  for (int i = 0x0000000; i < 0xFFFFFFF; i++) {
-    asm volatile("nop");
-  }
-}
+#include <string.h>
 
 int  atoi( char* x        ) {
   char* p = x; bool s = false; int r = 0;
@@ -131,6 +125,21 @@ void exec( const void* x ) {
   return;
 }
 
+pid_t spawn( const void* x, int p, char* argv[] ) {
+  pid_t r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =    x
+                "mov r1, %3 \n" // assign r1 =    p
+                "mov r2, %4 \n" // assign r2 = argv
+                "svc %1     \n" // make system call SYS_SPAWN
+                "mov %0, r0 \n" // assign r  =   r0
+              : "=r" (r)
+              : "I" (SYS_SPAWN), "r" (x), "r" (p), "r" (argv)
+              : "r0", "r1", "r2", "memory" );
+
+  return r;
+}
+
 int  kill( int pid, int x ) {
   int r;
 
@@ -156,34 +165,536 @@ void nice( int pid, int x ) {
   return;
 }
 
+void sleep( uint32_t x ) {
+  asm volatile( "mov r0, %1 \n" // assign r0 =  x
+                "svc %0     \n" // make system call SYS_SLEEP
+              :
+              : "I" (SYS_SLEEP), "r" (x)
+              : "r0" );
+
+  return;
+}
+
+int  ps( int i, procstat_t* x ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  i
+                "mov r1, %3 \n" // assign r1 =  x
+                "svc %1     \n" // make system call SYS_PS
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_PS), "r" (i), "r" (x)
+              : "r0", "r1", "memory" );
+
+  return r;
+}
+
+int  slab( int i, slabstat_t* x ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  i
+                "mov r1, %3 \n" // assign r1 =  x
+                "svc %1     \n" // make system call SYS_SLAB
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_SLAB), "r" (i), "r" (x)
+              : "r0", "r1", "memory" );
+
+  return r;
+}
+
+void* brk( void* x ) {
+  void* r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  x
+                "svc %1     \n" // make system call SYS_BRK
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_BRK), "r" (x)
+              : "r0" );
+
+  return r;
+}
+
+void* sbrk( int n ) {
+  uint8_t* x = brk( NULL );
+
+  if( n != 0 && brk( x + n ) == ( void* )( -1 ) ) {
+    return ( void* )( -1 );
+  }
+
+  return x;
+}
+
+static inline int  ldrex( volatile int* x ) {
+  int r;
+
+  asm volatile( "ldrex %0, [ %1 ] \n"     // r = MEM[ x ]
+              : "=r" (r)
+              : "r" (x)
+              : "memory" );
+
+  return r;
+}
+
+static inline int  strex( volatile int* x, int v ) {
+  int r;
+
+  asm volatile( "strex %0, %2, [ %1 ] \n" // r <= MEM[ x ] = v
+              : "=&r" (r)
+              : "r" (x), "r" (v)
+              : "memory" );
+
+  return r;
+}
+
+static inline void dmb() {
+  asm volatile( "dmb \n" : : : "memory" );  // memory barrier
+}
+
+/* malloc hands out blocks of MALLOC_MIN, 2 * MALLOC_MIN, ... MALLOC_MAX bytes
+ * (each including an 8-byte header), and keeps a free list per size class;
+ * anything larger gets a whole number of pages, kept in a first-fit list
+ * once freed.  Blocks are carved out of memory taken from the kernel via
+ * sbrk, at least MALLOC_CHUNK bytes at a time.  Blocks are never split,
+ * merged or given back, so malloc and free are constant time (bar the search
+ * for a large block).
+ *
+ * The globals here are shared by every process, whereas the heap is not: so
+ * the state of malloc, an arena_t, lives at HEAP_BASE instead.  The threads
+ * of a process do share its heap, and so the arena, which is therefore
+ * locked; but each thread also caches up to MALLOC_CACHE free blocks per size
+ * class, which it can allocate and free without the lock, and only moves
+ * them to or from the arena MALLOC_BATCH at a time.  A thread's cache lives
+ * in its thread_t, found via TPIDRURO (which the kernel sets per thread),
+ * or, for the thread that created the process, in the arena.
+ */
+
+#define MALLOC_MIN     ( 16     )
+#define MALLOC_MAX     ( 4096   )
+#define MALLOC_CLASSES ( 9      )
+#define MALLOC_PAGE    ( 0x1000 )
+#define MALLOC_CHUNK   ( 0x4000 )
+#define MALLOC_CACHE   ( 16     )
+#define MALLOC_BATCH   ( 8      )
+
+typedef struct block_t {
+  uint32_t        size; // bytes in the block, including this header
+  struct block_t* next; // while free, the next block in the same list
+} block_t;
+
+typedef struct {
+  block_t* free[ MALLOC_CLASSES ];
+  int      n   [ MALLOC_CLASSES ]; // blocks in each list
+} cache_t;
+
+typedef struct {
+  volatile int lock;    // 0 => free, 1 => held, 2 => held, and maybe waited for
+
+  block_t* free[ MALLOC_CLASSES ];
+  block_t* large;
+
+  uint8_t* top;         // memory not yet carved into blocks, i.e., [ top, end )
+  uint8_t* end;
+
+  cache_t  cache;       // of the thread that created the process
+} arena_t;
+
+// what the C library keeps per thread, just above its stack
+typedef struct {
+  void  ( *f )( void* );
+  void*    x;
+
+  cache_t  cache;
+} thread_t;
+
+static void arena_lock( arena_t* a ) {
+  volatile int* s = &a->lock; int w = 1;
+
+  while( true ) {
+    int v = ldrex( s );                    // s' = MEM[&s]
+
+    if( v == 0 ) {
+      if( strex( s, w ) ) {                // retry if MEM[&s] = w failed
+        continue;
+      }
+
+      dmb();
+
+      return;
+    }
+
+    // mark the lock as contended, then block until it is released; having
+    // waited once, take it as contended too, since others may still wait
+    if( v == 1 && strex( s, 2 ) ) {
+      continue;
+    }
+
+    futex_wait( ( const void* )( s ), 2 ); w = 2;
+  }
+}
+
+static void arena_unlock( arena_t* a ) {
+  volatile int* s = &a->lock; int v;
+
+  dmb();
+
+  do {
+    v = ldrex( s );                        // s' = MEM[&s]
+  } while( strex( s, 0 ) );                // retry until MEM[&s] = 0 sticks
+
+  if( v == 2 ) {
+    futex_wake( ( const void* )( s ), 1 );
+  }
+}
+
+static cache_t* arena_cache( arena_t* a ) {
+  thread_t* t;
+
+  asm volatile( "mrc p15, 0, %0, c13, c0, 3 \n" // read TPIDRURO
+              : "=r" (t) );
+
+  return ( t != NULL ) ? &t->cache : &a->cache;
+}
+
+// the caller must hold the lock
+static block_t* arena_carve( arena_t* a, uint32_t n ) {
+  // the heap is zeroed, so end is NULL until the process first uses malloc
+  if( a->end == NULL ) {
+    a->top = ( uint8_t* )( HEAP_BASE ) + ( ( sizeof( arena_t ) + 7 ) & ~7 );
+    a->end = ( uint8_t* )( HEAP_BASE ) + HEAP_INIT;
+  }
+
+  if( ( a->end - a->top ) < n ) {
+    uint32_t m = ( ( n > MALLOC_CHUNK ) ? n : MALLOC_CHUNK ) + 8;
+
+    // which also keeps m within the int sbrk takes
+    if( m > HEAP_SIZE ) {
+      return NULL;
+    }
+
+    uint8_t* x = sbrk( ( int )( m ) );
+
+    if( x == ( void* )( -1 ) ) {
+      return NULL;
+    }
+
+    // the rest of [ top, end ) is lost if anything else moved the break
+    if( x != a->end ) {
+      a->top = ( uint8_t* )( ( ( uint32_t )( x ) + 7 ) & ~7 );
+    }
+
+    a->end = x + m;
+  }
+
+  block_t* b = ( block_t* )( a->top );
+
+  a->top += n;
+  b->size = n;
+
+  return b;
+}
+
+// move up to MALLOC_BATCH blocks of class i from the arena into c, carving
+// new ones if there are none free
+static void arena_fill( arena_t* a, cache_t* c, int i ) {
+  arena_lock( a );
+
+  for( int j = 0; j < MALLOC_BATCH; j++ ) {
+    block_t* b = a->free[ i ];
+
+    if( b != NULL ) {
+      a->free[ i ] = b->next;
+    }
+    else if( ( b = arena_carve( a, MALLOC_MIN << i ) ) == NULL ) {
+      break;
+    }
+
+    b->next = c->free[ i ]; c->free[ i ] = b; c->n[ i ]++;
+  }
+
+  arena_unlock( a );
+}
+
+// move up to n blocks of class i from c back into the arena
+static void arena_drain( arena_t* a, cache_t* c, int i, int n ) {
+  arena_lock( a );
+
+  for( ; n > 0 && c->free[ i ] != NULL; n-- ) {
+    block_t* b = c->free[ i ];
+
+    c->free[ i ] = b->next; c->n[ i ]--;
+    b->next = a->free[ i ]; a->free[ i ] = b;
+  }
+
+  arena_unlock( a );
+}
+
+void* malloc( size_t n ) {
+  arena_t* a = ( arena_t* )( HEAP_BASE );
+  uint32_t m = n + sizeof( block_t );
+  block_t* b;
+
+  // nothing bigger could fit in the heap, and this also means neither m nor
+  // rounding it up to a whole number of pages below can wrap around
+  if( n > HEAP_SIZE ) {
+    return NULL;
+  }
+
+  if( m <= MALLOC_MAX ) {
+    cache_t* c = arena_cache( a ); int i = 0;
+
+    while( ( MALLOC_MIN << i ) < m ) {
+      i++;
+    }
+
+    if( c->free[ i ] == NULL ) {
+      arena_fill( a, c, i );
+    }
+
+    if( ( b = c->free[ i ] ) != NULL ) {
+      c->free[ i ] = b->next; c->n[ i ]--;
+    }
+  }
+  else {
+    block_t** p = &a->large;
+
+    m = ( m + MALLOC_PAGE - 1 ) & ~( MALLOC_PAGE - 1 );
+
+    arena_lock( a );
+
+    while( *p != NULL && ( *p )->size < m ) {
+      p = &( *p )->next;
+    }
+
+    if( ( b = *p ) != NULL ) {
+      *p = b->next;
+    }
+    else {
+      b = arena_carve( a, m );
+    }
+
+    arena_unlock( a );
+  }
+
+  return ( b != NULL ) ? ( b + 1 ) : NULL;
+}
+
+void* calloc( size_t n, size_t m ) {
+  if( m != 0 && n > ( ( size_t )( -1 ) / m ) ) {
+    return NULL;
+  }
+
+  void* x = malloc( n * m );
+
+  if( x != NULL ) {
+    memset( x, 0, n * m );
+  }
+
+  return x;
+}
+
+void  free( void* x ) {
+  arena_t* a = ( arena_t* )( HEAP_BASE );
+  block_t* b = ( block_t* )( x ) - 1;
+
+  if( x == NULL ) {
+    return;
+  }
+
+  if( b->size <= MALLOC_MAX ) {
+    cache_t* c = arena_cache( a ); int i = __builtin_ctz( b->size / MALLOC_MIN );
+
+    b->next = c->free[ i ]; c->free[ i ] = b; c->n[ i ]++;
+
+    if( c->n[ i ] > MALLOC_CACHE ) {
+      arena_drain( a, c, i, MALLOC_BATCH );
+    }
+  }
+  else {
+    arena_lock( a );
+
+    b->next = a->large;     a->large     = b;
+
+    arena_unlock( a );
+  }
+}
+
+// a thread starts here (see thread_create), and gives back what it cached
+// before it exits
+static void thread_start( thread_t* t ) {
+  t->f( t->x );
+
+  for( int i = 0; i < MALLOC_CLASSES; i++ ) {
+    arena_drain( ( arena_t* )( HEAP_BASE ), &t->cache, i, t->cache.n[ i ] );
+  }
+
+  exit( EXIT_SUCCESS );
+}
+
+pid_t thread_create( void ( *f )( void* ), void* x, void* stack ) {
+  thread_t* t = ( thread_t* )( ( ( uint32_t )( stack ) - sizeof( thread_t ) ) & ~7 );
+  pid_t     r;
+
+  memset( t, 0, sizeof( thread_t ) );
+
+  t->f = f;
+  t->x = x;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 = thread_start
+                "mov r1, %3 \n" // assign r1 = t
+                "mov r2, %3 \n" // assign r2 = t
+                "svc %1     \n" // make system call SYS_THREAD_CREATE
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_THREAD_CREATE), "r" (&thread_start), "r" (t)
+              : "r0", "r1", "r2", "memory" );
+
+  return r;
+}
+
+int   thread_join( pid_t pid ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  pid
+                "svc %1     \n" // make system call SYS_THREAD_JOIN
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_THREAD_JOIN), "r" (pid)
+              : "r0", "memory" );
+
+  return r;
+}
+
+int  sync() {
+  int r;
+
+  asm volatile( "svc %1     \n" // make system call SYS_SYNC
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_SYNC)
+              : "r0" );
+
+  return r;
+}
+
+int  bread ( uint32_t a,       void* x ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  a
+                "mov r1, %3 \n" // assign r1 =  x
+                "svc %1     \n" // make system call SYS_BREAD
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_BREAD), "r" (a), "r" (x)
+              : "r0", "r1", "memory" );
+
+  return r;
+}
+
+int  bwrite( uint32_t a, const void* x ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  a
+                "mov r1, %3 \n" // assign r1 =  x
+                "svc %1     \n" // make system call SYS_BWRITE
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_BWRITE), "r" (a), "r" (x)
+              : "r0", "r1", "memory" );
+
+  return r;
+}
+
+int  bstat( bcachestat_t* x ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  x
+                "svc %1     \n" // make system call SYS_BSTAT
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_BSTAT), "r" (x)
+              : "r0", "memory" );
+
+  return r;
+}
+
+int  futex_wait( const void* x, int v ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  x
+                "mov r1, %3 \n" // assign r1 =  v
+                "svc %1     \n" // make system call SYS_FUTEX_WAIT
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_FUTEX_WAIT), "r" (x), "r" (v)
+              : "r0", "r1", "memory" );
+
+  return r;
+}
+
+int  futex_wake( const void* x, int n ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  x
+                "mov r1, %3 \n" // assign r1 =  n
+                "svc %1     \n" // make system call SYS_FUTEX_WAKE
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_FUTEX_WAKE), "r" (x), "r" (n)
+              : "r0", "r1", "memory" );
+
+  return r;
+}
+
 // sem_post and sem_wait functions are used to control race-conditions
 
 void sem_post(const void* x) {
-  asm volatile("ldrex r1, [ r0 ] \n"      // s' = MEM[&s]
-               "add r1, r1, #1 \n"        // s' = s' + 1
-               "strex r2, r1, [ r0 ] \n"  // r <= MEM[ &s ] = s'
-               "cmp r2, #0 \n"            // r ?= 0
-               "bne sem_post \n"          // if r != 0 retry
-               "dmb \n"                   // memory barrier
-               "bx lr \n"                 // return
-               :
-               : "r"(x)
-               :"r0", "r1", "r2");
+  volatile int* s = ( volatile int* )( x ); int v;
+
+  dmb();
+
+  do {
+    v = ldrex( s );                        // s' = MEM[&s]
+  } while( strex( s, ( v < 0 ) ? 1 : v + 1 ) ); // retry until MEM[&s] = s' + 1 sticks
+
+  // a -1 count means someone may be blocked: hand them the count just posted
+  if( v < 0 ) {
+    futex_wake( x, 1 );
+  }
+
   return;
 }
 
 void sem_wait(const void* x) {
-  asm volatile("ldrex r1, [ r0 ] \n"      // s' = MEM[&s]
-               "cmp r1, #0 \n"            // s' ?= 0
-               "beq sem_wait \n"          // if s' == 0, retry
-               "sub r1, r1, #1 \n"        // s' = s' - 1
-               "strex r2, r1, [ r0 ] \n"  // r <= MEM[ &s ] = s'
-               "cmp r2, #0 \n"            // r ?= 0
-               "bne sem_wait \n"          // if r != 0, retry
-               "dmb \n"                   // memory barrier
-               "bx lr \n"                 // return
-               :
-               : "r"(x)
-               :"r0", "r1", "r2");
-  return;
+  volatile int* s = ( volatile int* )( x ); bool others = false;
+
+  while( true ) {
+    int v = ldrex( s );                    // s' = MEM[&s]
+
+    if( v > 0 ) {
+      // having been woken while others still wait, keep the semaphore marked
+      // as contended, or pass any spare count on to the next waiter
+      int n = ( others && v == 1 ) ? -1 : v - 1;
+
+      if( strex( s, n ) ) {                // retry if MEM[&s] = s' - 1 failed
+        continue;
+      }
+
+      dmb();
+
+      if( others && n > 0 ) {
+        futex_wake( x, 1 );
+      }
+
+      return;
+    }
+
+    // s' <= 0: mark the semaphore as contended, then block until it is posted
+    if( v == 0 && strex( s, -1 ) ) {
+      continue;
+    }
+
+    others = ( futex_wait( x, -1 ) > 0 );
+  }
 }
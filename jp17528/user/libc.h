@@ -38,6 +38,19 @@ typedef int pid_t;
 #define SYS_EXEC      ( 0x05 )
 #define SYS_KILL      ( 0x06 )
 #define SYS_NICE      ( 0x07 )
+#define SYS_SLEEP     ( 0x08 )
+#define SYS_FUTEX_WAIT ( 0x09 )
+#define SYS_FUTEX_WAKE ( 0x0A )
+#define SYS_PS        ( 0x0B )
+#define SYS_SLAB      ( 0x0C )
+#define SYS_BRK       ( 0x0D )
+#define SYS_SPAWN     ( 0x0E )
+#define SYS_THREAD_CREATE ( 0x0F )
+#define SYS_THREAD_JOIN   ( 0x10 )
+#define SYS_SYNC      ( 0x11 )
+#define SYS_BREAD     ( 0x12 )
+#define SYS_BWRITE    ( 0x13 )
+#define SYS_BSTAT     ( 0x14 )
 
 #define SIG_TERM      ( 0x00 )
 #define SIG_QUIT      ( 0x01 )
@@ -48,6 +61,76 @@ typedef int pid_t;
 #define  STDIN_FILENO ( 0 )
 #define STDOUT_FILENO ( 1 )
 #define STDERR_FILENO ( 2 )
+#define CONSOLE_FILENO ( 3 )
+
+// A snapshot of the per-process accounting the kernel maintains, as returned
+// by ps: times are in milliseconds, and syscalls counts the system calls made
+// by identifier (e.g., syscalls[ SYS_WRITE ]).  The layout must match that of
+// procstat_t in the kernel.
+
+#define NSYSCALLS     ( 32 )
+
+#define PROC_CREATED  ( 1 )
+#define PROC_READY    ( 3 )
+#define PROC_EXECUTING ( 4 )
+#define PROC_WAITING  ( 5 )
+
+typedef struct {
+  pid_t    pid;           // -1 denotes the idle process
+  pid_t    tgid;          // thread group, i.e., pid unless a thread
+  int      status;        // PROC_...
+  int      base_priority;
+  uint32_t cpu_time;      // time spent executing
+  uint32_t wait_time;     // time spent blocked (e.g., asleep, or waiting for I/O)
+  uint32_t nvcsw;         // voluntary   context switches
+  uint32_t nivcsw;        // involuntary context switches
+  uint32_t syscalls[ NSYSCALLS ];
+} procstat_t;
+
+// The statistics the kernel keeps for each cache of its heap, as returned by
+// slab: objects of size bytes are carved out of slabs pages, and used of them
+// are allocated, avail are free; fails counts allocations that failed for
+// lack of memory.  Entry 0 is the page allocator itself (so slabs is the
+// size of the heap in pages).  The layout must match that of slabstat_t in
+// the kernel.
+
+typedef struct {
+  char     name[ 16 ];
+  uint32_t size;
+  uint32_t slabs;
+  uint32_t used;
+  uint32_t avail;
+  uint32_t allocs;
+  uint32_t fails;
+} slabstat_t;
+
+// The statistics of the kernel's block cache, as returned by bstat: it holds
+// up to bufs blocks of the disk (of num blocks, each len bytes), used of
+// which are cached and dirty of which are yet to be written back;
+// readaheads counts blocks read before they were asked for.  The layout
+// must match that of bcachestat_t in the kernel.
+
+typedef struct {
+  uint32_t num;
+  uint32_t len;
+  uint32_t bufs;
+  uint32_t used;
+  uint32_t dirty;
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t writebacks;
+  uint32_t readaheads;
+} bcachestat_t;
+
+// The heap of each process starts at HEAP_BASE, and ends at its break, which
+// brk and sbrk move; it is private to the process (and copied on fork), bar
+// that it is shared by every thread the process creates.  Its
+// first HEAP_INIT bytes are always there, and malloc keeps its state in them;
+// it can never grow past HEAP_SIZE bytes, the window it shares with the stack.
+
+#define HEAP_BASE     ( 0x20000000 )
+#define HEAP_INIT     ( 0x00001000 )
+#define HEAP_SIZE     ( 0x00100000 )
 
 // convert ASCII string x into integer r
 extern int  atoi( char* x        );
@@ -59,7 +142,8 @@ extern void yield();
 
 // write n bytes from x to   the file descriptor fd; return bytes written
 extern int write( int fd, const void* x, size_t n );
-// read  n bytes into x from the file descriptor fd; return bytes read
+// read  n bytes into x from the file descriptor fd; return bytes read,
+// which stops short after a '\n' (and blocks until one, or n bytes, arrive)
 extern int  read( int fd,       void* x, size_t n );
 
 // perform fork, returning 0 iff. child or > 0 iff. parent process
@@ -68,16 +152,75 @@ extern int  fork();
 extern void exit(       int   x );
 // perform exec, i.e., start executing program at address x
 extern void exec( const void* x );
+// perform spawn, i.e., start executing program at address x in a new process
+// with priority p, passed argc and a copy of argv (a NULL terminated array,
+// or NULL); return its PID, or -1 on failure
+extern pid_t spawn( const void* x, int p, char* argv[] );
 
 // for process identified by pid, send signal of x
 extern int  kill( pid_t pid, int x );
 // for process identified by pid, set  priority to x
 extern void nice( pid_t pid, int x );
 
+// snapshot the i-th process onward into x; return the i to use next time,
+// or -1 if there are no more processes (so start from i = 0)
+extern int  ps( int i, procstat_t* x );
+
+// snapshot the i-th kernel heap cache into x; return the i to use next time,
+// or -1 if there are no more caches (so start from i = 0)
+extern int  slab( int i, slabstat_t* x );
+
+// set the break to x, unless x is NULL; return the break, or -1 on failure
+extern void* brk( void* x );
+// move the break by n bytes; return the old break, or -1 on failure
+extern void* sbrk( int n );
+
+// allocate n bytes, 8-byte aligned, on the heap; return NULL on failure
+extern void* malloc( size_t n );
+// allocate n elements of m bytes each, zeroed; return NULL on failure
+extern void* calloc( size_t n, size_t m );
+// free x, as allocated by malloc or calloc (or do nothing if x is NULL)
+extern void  free( void* x );
+
+// create a thread, i.e., a process sharing the caller's address space, that
+// executes f( x ) then exits; it runs on the stack below address stack (a
+// few words of which it uses to keep track of itself), which must stay valid
+// until it has terminated.  Return its PID, or -1 on failure
+extern pid_t thread_create( void ( *f )( void* ), void* x, void* stack );
+// block until the thread pid has terminated; return 0, or -1 on failure (e.g.,
+// if pid is not a thread in the caller's group)
+extern int   thread_join( pid_t pid );
+
+// write every dirty block in the kernel's block cache back to the disk;
+// return 0, or -1 on failure
+extern int  sync();
+// read  block a of the disk into x, which has room for bstat's len bytes,
+// via the block cache; return 0, or -1 on failure
+extern int  bread ( uint32_t a,       void* x );
+// write block a of the disk from x, via the block cache (so it reaches the
+// disk later, or at the next sync); return 0, or -1 on failure
+extern int  bwrite( uint32_t a, const void* x );
+// snapshot the statistics of the block cache into x; return 0, or -1 on
+// failure
+extern int  bstat( bcachestat_t* x );
+
+// block (without using the processor) for at least x milliseconds, bar that
+// the kernel caps x at about 35 minutes
+extern void sleep( uint32_t x );
+
+// block iff. the int at address x holds v, until woken via futex_wake; return
+// the number of processes still waiting on x once woken, or -1 if *x != v
+extern int futex_wait( const void* x, int v );
+// wake up to n processes blocked on address x; return the number woken
+extern int futex_wake( const void* x, int n );
+
 // Funcitons for DP
+//
+// A semaphore is an int holding its count, or -1 meaning "0, and there may
+// be processes blocked on it"; only sem_post on a -1 semaphore, or sem_wait
+// on a 0 one, needs to enter the kernel.
 extern void sem_post(const void* x);
 extern void sem_wait(const void* x);
-extern void sleep();
 
 
 